@@ -177,7 +177,8 @@ hal_bsp_init(void)
     rc = hal_timer_init(1, &tmr_cfg);
     assert(rc == 0);
 #endif
-#if MYNEWT_VAL(TIMER_2)
+/* With TIMER_COUNT32, TC5 is the upper half of TIMER_1's counter */
+#if MYNEWT_VAL(TIMER_2) && !MYNEWT_VAL(TIMER_COUNT32)
     tmr_cfg.clkgen = GCLK_GENERATOR_6;
     tmr_cfg.src_clock = GCLK_SOURCE_OSC8M;
     tmr_cfg.hwtimer = TC5;
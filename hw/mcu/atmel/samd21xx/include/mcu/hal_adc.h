@@ -20,6 +20,8 @@
 #ifndef _SAMD21_HAL_ADC_H
 #define _SAMD21_HAL_ADC_H
 
+#include <stdint.h>
+
 /* this structure is passed to the BSP for configuration options */
 enum samd_adc_reference_voltage {
 	SAMD21_ADC_REFERENCE_INT1V,
@@ -80,10 +82,32 @@ struct samd21_adc_config {
     int                             voltage_mvolts;
 };
 
-/* This creates a new ADC object for this ADC source */
-struct hal_adc * 
-samd21_adc_create(enum samd_adc_analog_channel chan, 
-                  const struct samd21_adc_config *pconfig);
+/*
+ * Called from interrupt context in continuous mode every time a buffer has
+ * been filled with cnt samples. The other buffer is being filled while
+ * this runs, so buf must be consumed before that one fills up.
+ */
+typedef void (*samd21_adc_buf_cb)(void *arg, uint16_t *buf, int cnt);
+
+/* Configures the ADC. Must be called before the other functions. */
+int samd21_adc_init(const struct samd21_adc_config *pconfig);
+
+/* Single conversion on chan. Blocks until the result is ready. */
+int samd21_adc_read(enum samd_adc_analog_channel chan, uint16_t *result);
+
+/* Resolution of the results, and reference voltage in millivolts. */
+int samd21_adc_get_bits(void);
+int samd21_adc_get_ref_mv(void);
+
+/*
+ * Starts free-running conversions on chan. Results are moved by DMA to
+ * buf0 and buf1 in turn, cnt samples each, and cb is called for each
+ * buffer as it fills. Runs until samd21_adc_stop().
+ */
+int samd21_adc_start(enum samd_adc_analog_channel chan,
+                     uint16_t *buf0, uint16_t *buf1, int cnt,
+                     samd21_adc_buf_cb cb, void *arg);
+int samd21_adc_stop(void);
 
 
 #endif /* _SAMD21_HAL_ADC_H */
@@ -0,0 +1,64 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SAMD21_HAL_CRC_H__
+#define _SAMD21_HAL_CRC_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * DMAC CRC engine. Data is fed to it through memory-to-memory DMA
+ * transfers, so the CPU only sets up one transfer per update. There is
+ * one engine; samd21_crc_begin() claims it until samd21_crc_end().
+ */
+#define SAMD21_CRC_16       (0)     /* CRC-CCITT, polynomial 0x1021 */
+#define SAMD21_CRC_32       (1)     /* IEEE 802.3 */
+
+/*
+ * Claims the engine and loads seed into the checksum register. With
+ * word_beats, updates must be word aligned and multiples of 4 bytes long.
+ * Returns 0 on success, EBUSY if engine is in use.
+ */
+int samd21_crc_begin(int type, uint32_t seed, int word_beats);
+
+/*
+ * Runs len bytes at data through the engine.
+ */
+int samd21_crc_update(const void *data, uint32_t len);
+
+/*
+ * Runs len bytes through the engine, all of them read from the same
+ * location; e.g. to get CRC of an area filled with one value.
+ */
+int samd21_crc_fill(const void *data, uint32_t len);
+
+/*
+ * Returns checksum register and releases the engine.
+ */
+uint32_t samd21_crc_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SAMD21_HAL_CRC_H__ */
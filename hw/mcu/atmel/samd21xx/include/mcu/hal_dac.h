@@ -20,6 +20,9 @@
 #ifndef HAL_DAC_H
 #define HAL_DAC_H 
 
+#include <stdint.h>
+#include "mcu/samd21.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,9 +40,29 @@ struct samd21_dac_config
     int                     dac_reference_voltage_mvolts;    
 };
 
-/* This creates a new DAC object for this DAC source */
-struct hal_dac * 
-samd21_dac_create(const struct samd21_dac_config *pconfig);
+int samd21_dac_init(const struct samd21_dac_config *pconfig);
+
+/* Sets DAC output right away. Value is 10 bits. */
+int samd21_dac_write(uint16_t val);
+int samd21_dac_get_bits(void);
+int samd21_dac_get_ref_mv(void);
+
+/*
+ * Streaming output. Conversions are paced by overflow of timer tc, at
+ * rate samples/sec. Sample buffers are queued with samd21_dac_queue(),
+ * and played back to back. cb is called from interrupt context when a
+ * buffer has been played, and can queue the next one.
+ *
+ * If the queue runs empty, output holds the last sample and underrun
+ * counter is incremented; playback resumes when a buffer is queued.
+ * Timer cannot be one which is used by hal_timer.
+ */
+typedef void (*samd21_dac_buf_cb)(void *arg, const uint16_t *buf, int cnt);
+
+int samd21_dac_start(Tc *tc, uint32_t rate, samd21_dac_buf_cb cb, void *arg);
+int samd21_dac_queue(const uint16_t *buf, int cnt);
+int samd21_dac_stop(void);
+uint32_t samd21_dac_underruns(void);
     
 #ifdef __cplusplus
 }
@@ -0,0 +1,93 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SAMD21_HAL_FLASH_H__
+#define _SAMD21_HAL_FLASH_H__
+
+#include <stdint.h>
+#include "os/os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Returns pointer to len bytes of internal flash at address, so they can
+ * be read in place; flash is memory mapped. NULL if range is not within
+ * flash. Data changes if the area is written or erased. Buffered writes
+ * to the range are written out first.
+ */
+const void *samd21_flash_ptr(uint32_t address, uint32_t len);
+
+/*
+ * Writes out flash page which has buffered data from previous writes
+ * (syscfg FLASH_WRITE_COMBINE). Must be called before reset or power
+ * down, when data written must be persistent.
+ */
+int samd21_flash_flush(void);
+
+/*
+ * CRC32 (IEEE 802.3) of len bytes of flash at address, computed with
+ * memory-to-memory DMA through the DMAC CRC engine (syscfg FLASH_DMA_CRC).
+ * Same value as the usual software CRC32 with 0xffffffff initial value
+ * and final complement. Returns 0 on success.
+ */
+int samd21_flash_crc32(uint32_t address, uint32_t len, uint32_t *crc);
+
+/*
+ * Checks whether flash range reads as erased, by comparing it against
+ * 0xff. Returns 1 if blank, 0 if not, -1 on error.
+ */
+int samd21_flash_is_blank(uint32_t address, uint32_t len);
+
+/*
+ * Asynchronous erase and write (syscfg FLASH_ASYNC). Operations are
+ * queued, and carried out one row or page at a time from the NVM
+ * controller interrupt. When one finishes, sfo_rc is set and sfo_ev
+ * is posted to sfo_evq; caller sets up sfo_ev and sfo_evq before
+ * submitting. Operation must not be touched until then.
+ *
+ * Erase address and length must be multiples of row size (256 bytes).
+ * Writes must be to erased flash, and source data must stay valid until
+ * completion. Blocking flash calls wait for the queue to empty.
+ */
+struct samd21_flash_op {
+    struct os_event sfo_ev;
+    struct os_eventq *sfo_evq;
+    int sfo_rc;
+
+    /* internal */
+    uint32_t sfo_addr;
+    uint32_t sfo_len;
+    uint32_t sfo_off;
+    const uint8_t *sfo_src;     /* NULL for erase */
+    uint8_t sfo_pbc;            /* page buffer cleared, write next */
+    STAILQ_ENTRY(samd21_flash_op) sfo_next;
+};
+
+int samd21_flash_erase_async(struct samd21_flash_op *op, uint32_t address,
+                             uint32_t len);
+int samd21_flash_write_async(struct samd21_flash_op *op, uint32_t address,
+                             const void *src, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SAMD21_HAL_FLASH_H__ */
@@ -0,0 +1,127 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SAMD21_HAL_GPIO_H__
+#define _SAMD21_HAL_GPIO_H__
+
+#include <stdint.h>
+#include "mcu/samd21.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * os_cputime at entry to the interrupt handler which last dispatched
+ * the external interrupt of pin (syscfg GPIO_IRQ_TIMESTAMP). Pins sharing
+ * an EIC channel share the timestamp. Returns 0 for pins without one.
+ */
+uint32_t samd21_gpio_irq_timestamp(int pin);
+
+/*
+ * Fast GPIO access through the single-cycle IOBUS alias of PORT. Pins
+ * are numbered as in hal_gpio (PA0-PA31 are 0-31, PB0-PB31 are 32-63),
+ * ports are 0 for A and 1 for B. No validation is done; pins must have
+ * been set up with hal_gpio_init_out()/hal_gpio_init_in() beforehand.
+ *
+ * Set, clear and toggle of a port mask are single writes, so they are
+ * atomic with respect to interrupts and each other.
+ */
+#define SAMD21_GPIO_PORT(pin)       ((pin) >> 5)
+#define SAMD21_GPIO_MASK(pin)       (1UL << ((pin) & 31))
+
+static inline void
+samd21_gpio_set_mask(int port, uint32_t mask)
+{
+    PORT_IOBUS->Group[port].OUTSET.reg = mask;
+}
+
+static inline void
+samd21_gpio_clear_mask(int port, uint32_t mask)
+{
+    PORT_IOBUS->Group[port].OUTCLR.reg = mask;
+}
+
+static inline void
+samd21_gpio_toggle_mask(int port, uint32_t mask)
+{
+    PORT_IOBUS->Group[port].OUTTGL.reg = mask;
+}
+
+/*
+ * Drives pins in mask of port to the corresponding bits of val, all of
+ * them changing at the same time. Read-modify-write of OUT is done with
+ * interrupts disabled.
+ */
+static inline void
+samd21_gpio_write_mask(int port, uint32_t mask, uint32_t val)
+{
+    uint32_t primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    PORT_IOBUS->Group[port].OUT.reg =
+      (PORT_IOBUS->Group[port].OUT.reg & ~mask) | (val & mask);
+    __set_PRIMASK(primask);
+}
+
+/*
+ * Input levels of all pins of port. Reading IN through IOBUS only sees
+ * pins with continuous sampling enabled, see samd21_gpio_sample_cont().
+ */
+static inline uint32_t
+samd21_gpio_read_port(int port)
+{
+    return PORT_IOBUS->Group[port].IN.reg;
+}
+
+static inline void
+samd21_gpio_fast_write(int pin, int val)
+{
+    if (val) {
+        samd21_gpio_set_mask(SAMD21_GPIO_PORT(pin), SAMD21_GPIO_MASK(pin));
+    } else {
+        samd21_gpio_clear_mask(SAMD21_GPIO_PORT(pin), SAMD21_GPIO_MASK(pin));
+    }
+}
+
+static inline void
+samd21_gpio_fast_toggle(int pin)
+{
+    samd21_gpio_toggle_mask(SAMD21_GPIO_PORT(pin), SAMD21_GPIO_MASK(pin));
+}
+
+static inline int
+samd21_gpio_fast_read(int pin)
+{
+    return !!(samd21_gpio_read_port(SAMD21_GPIO_PORT(pin)) &
+              SAMD21_GPIO_MASK(pin));
+}
+
+/*
+ * Enables continuous input sampling for pins in mask of port, needed for
+ * reads through IOBUS. Costs some power while enabled.
+ */
+void samd21_gpio_sample_cont(int port, uint32_t mask, int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SAMD21_HAL_GPIO_H__ */
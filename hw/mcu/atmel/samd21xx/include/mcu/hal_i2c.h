@@ -46,6 +46,44 @@ struct samd21_i2c_config {
     /* TODO baudrate and high speed */
 };
 
+/*
+ * Per bus counters, for all hal_i2c and samd21_i2c operations.
+ */
+struct samd21_i2c_stats {
+    uint32_t sis_bytes;         /* data bytes moved in successful transfers */
+    uint32_t sis_nacks;         /* address or data not acknowledged */
+    uint32_t sis_bus_errors;
+    uint32_t sis_arb_lost;      /* arbitration lost to another master */
+    uint32_t sis_timeouts;
+};
+
+int samd21_i2c_stats_get(uint8_t i2c_num, struct samd21_i2c_stats *stats);
+
+/*
+ * Called from interrupt context when samd21_i2c_read_reg() finishes;
+ * rc is 0 (STATUS_OK) on success, otherwise an ASF enum status_code.
+ */
+typedef void (*samd21_i2c_done_t)(void *arg, int rc);
+
+/*
+ * Writes reg_len bytes from reg to the device at address, and reads len
+ * bytes into buf after a repeated start (syscfg I2C_DMA). Register write
+ * is done before returning; the read moves data with DMA, and done is
+ * called when it's over. Bus must not be used by others meanwhile;
+ * STATUS_BUSY if it is. reg and buf must stay valid until done is called.
+ *
+ * Returns 0 or an ASF enum status_code, never an errno value: e.g.
+ * STATUS_ERR_INVALID_ARG for bad arguments, STATUS_ERR_IO if DMA could not
+ * be started, or the status of the register write.
+ *
+ * There is no timeout; samd21_i2c_abort() ends the operation, calling
+ * done with STATUS_ABORTED, and resets the bus.
+ */
+int samd21_i2c_read_reg(uint8_t i2c_num, uint8_t address, const void *reg,
+                        uint8_t reg_len, void *buf, uint16_t len,
+                        samd21_i2c_done_t done, void *arg);
+void samd21_i2c_abort(uint8_t i2c_num);
+
 /* This creates a new I2C object based on the samd21 TC devices */
 struct hal_i2c *
 samd21_i2c_create(enum samd21_i2c_device dev_id,
@@ -20,6 +20,8 @@
 #ifndef _SAMD21_HAL_PWM_H__
 #define _SAMD21_HAL_PWM_H__
 
+#include <stdint.h>
+
 /* this is where the pin definitions are */
 #include "../../src/sam0/utils/header_files/io.h"
 
@@ -45,15 +47,22 @@ enum samd_tc_tcc_clock_prescaler {
 	SAMD_TC_CLOCK_PRESCALER_DIV1024,
 };
 
+/*
+ * clock_freq is the PWM frequency in Hz. Timer is clocked from GCLK0
+ * through the prescaler, and counts up to the period derived from that.
+ */
 struct samd21_pwm_tc_config {
     enum samd_tc_tcc_clock_prescaler prescalar;
     int                              clock_freq;
 };
 
-/* This creates a new PWM object based on the samd21 TC devices */
-struct hal_pwm * 
-samd21_pwm_tc_create(enum samd_tc_device_id id, int channel, int pin,
-                  const struct samd21_pwm_tc_config *pconfig);
+/*
+ * TC runs in match PWM mode, 16 bits: CC0 holds the period, so only
+ * channel 1 (WO[1]) is usable as output. TC3 shares its clock with TCC2,
+ * TC4 with TC5. Don't use a TC here which is also used by hal_timer.
+ */
+int samd21_pwm_tc_init(enum samd_tc_device_id id,
+                       const struct samd21_pwm_tc_config *pconfig);
 
 
 enum samd_tcc_device_id {
@@ -68,9 +77,58 @@ struct samd21_pwm_tcc_config {
 };
 
 
-struct hal_pwm * 
-samd21_pwm_tcc_create(enum samd_tcc_device_id id, int channel, int pin,
-                  const struct samd21_pwm_tcc_config *pconfig);
+/*
+ * TCC runs in normal PWM mode, with period in PER and one channel per CC
+ * register: 4 on TCC0, 2 on TCC1 and TCC2. Compare values are written to
+ * the buffer registers, and take effect at the next period boundary.
+ */
+int samd21_pwm_tcc_init(enum samd_tcc_device_id id,
+                        const struct samd21_pwm_tcc_config *pconfig);
+
+/*
+ * The rest of the API takes a PWM device number; TC and TCC devices
+ * map to these with the macros below.
+ */
+#define SAMD21_PWM_TC(id)           ((int)(id))
+#define SAMD21_PWM_TCC(id)          (3 + (int)(id))
+#define SAMD21_PWM_MAX              6
+
+/*
+ * Routes a PWM output to a pin. pinmux is one of the PINMUX_Pxxx_TCy_WOz
+ * or PINMUX_Pxxx_TCCy_WOz values from the part header.
+ */
+int samd21_pwm_pin_config(int pwm, uint32_t pinmux);
+
+/* Number of timer counts in one period; duty cycles go from 0 to this. */
+uint32_t samd21_pwm_get_top(int pwm);
+
+int samd21_pwm_enable(int pwm);
+int samd21_pwm_disable(int pwm);
+
+/*
+ * Sets duty cycle of one channel, in timer counts. New value takes effect
+ * at the start of the next period, so there are no partial pulses.
+ */
+int samd21_pwm_set_duty(int pwm, int channel, uint32_t duty);
+
+/*
+ * Sets duty cycle of all channels in chan_mask, duty[n] for channel n.
+ * All of them change at the same period boundary.
+ */
+int samd21_pwm_set_duties(int pwm, uint8_t chan_mask, const uint32_t *duty);
+
+/*
+ * Streams duty cycle values from table to one channel with DMA, one entry
+ * per period. Table entries are uint16_t for TC and uint32_t for TCC
+ * devices. If repeat is set, table is played in a loop and cb is called
+ * every time it wraps; otherwise cb is called once at the end.
+ * Called from interrupt context.
+ */
+typedef void (*samd21_pwm_dma_cb)(void *arg);
+
+int samd21_pwm_dma_start(int pwm, int channel, const void *table, int cnt,
+                         int repeat, samd21_pwm_dma_cb cb, void *arg);
+int samd21_pwm_dma_stop(int pwm);
 
 
 #endif /* _SAMD21_HAL_PWM_H__ */
\ No newline at end of file
@@ -41,6 +41,37 @@ struct samd21_uart_config {
 */
 const struct samd21_uart_config *bsp_uart_config(int port);
 
+/*
+ * DMA receive mode (syscfg UART_DMA). Received data is written by DMA
+ * into circular buffer buf, and handed out in blocks when either half of
+ * it fills up, or when the line has been idle for UART_DMA_RX_IDLE_US.
+ * Callback gets the argument given to hal_uart_init_cbs(), and is called
+ * from interrupt context; data must be consumed before returning.
+ * If rx_blk is NULL, data is passed to the hal_uart_rx_char callback one
+ * character at a time instead.
+ *
+ * Must be called before hal_uart_config(). len must be even. 9 bit
+ * characters are not supported in this mode.
+ */
+typedef void (*samd21_uart_rx_block)(void *arg, uint8_t *data, int len);
+
+int samd21_uart_rx_dma(int port, uint8_t *buf, int len,
+                       samd21_uart_rx_block rx_blk);
+
+/*
+ * Sends len bytes from data with one DMA job (syscfg UART_DMA). done is
+ * called from interrupt context with the hal_uart_init_cbs() argument
+ * once all of it has been handed to the UART; data must stay valid until
+ * then. A producer with a ring buffer can send up to the wrap point, and
+ * the rest from the done callback.
+ * done must not be NULL.
+ * Returns -1 on error, or if transmit is already in progress.
+ */
+typedef void (*samd21_uart_tx_done)(void *arg);
+
+int samd21_uart_tx_dma(int port, const uint8_t *data, int len,
+                       samd21_uart_tx_done done);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,356 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "syscfg/syscfg.h"
+#include "compiler.h"
+#include "mcu/hal_adc.h"
+#include "mcu/samd21.h"
+#include "sam0/drivers/adc/adc.h"
+#include "sam0/drivers/dma/dma.h"
+#include "samd21_priv.h"
+
+#if MYNEWT_VAL(ADC)
+
+/* Max ADC clock is 2.1MHz */
+#define SAMD21_ADC_MAX_CLK          2100000
+
+#define SAMD21_ADC_FLAG_INIT        (0x1)
+#define SAMD21_ADC_FLAG_RUNNING     (0x2)
+
+struct samd21_hal_adc {
+    struct adc_module               module;
+    struct adc_config               config;
+    uint8_t                         flags;
+    int                             ref_mv;
+    int                             chan;       /* input ADC is set up for */
+
+    /*
+     * Continuous mode. The two descriptors are linked to each other, so
+     * the DMA channel keeps alternating between buffers until stopped.
+     */
+    struct dma_resource             dma;
+    COMPILER_ALIGNED(16) DmacDescriptor dma_desc[2];
+    uint16_t                       *buf[2];
+    uint16_t                        cnt;
+    uint8_t                         cur;        /* buffer being filled */
+    samd21_adc_buf_cb               cb;
+    void                           *cb_arg;
+};
+
+static struct samd21_hal_adc samd21_hal_adc;
+
+static int
+samd21_adc_input(enum samd_adc_analog_channel chan,
+                 enum adc_positive_input *input)
+{
+    switch (chan) {
+    case SAMD21_ANALOG_TEMP:
+        *input = ADC_POSITIVE_INPUT_TEMP;
+        break;
+    case SAMD21_ANALOG_BANDGAP:
+        *input = ADC_POSITIVE_INPUT_BANDGAP;
+        break;
+    case SAMD21_ANALOG_SCALEDCOREVCC:
+        *input = ADC_POSITIVE_INPUT_SCALEDCOREVCC;
+        break;
+    case SAMD21_ANALOG_SCALEDIOVCC:
+        *input = ADC_POSITIVE_INPUT_SCALEDIOVCC;
+        break;
+    case SAMD21_ANALOG_ADC_DAC:
+        *input = ADC_POSITIVE_INPUT_DAC;
+        break;
+    default:
+        if (chan < SAMD21_ANALOG_0 || chan > SAMD21_ANALOG_19) {
+            return EINVAL;
+        }
+        *input = (enum adc_positive_input)ADC_INPUTCTRL_MUXPOS(chan);
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Reprograms the ADC for a different input and/or mode. ASF sets up the
+ * pin mux for the input as part of adc_init(), so the module is reset and
+ * configured again from scratch.
+ */
+static int
+samd21_adc_setup(struct samd21_hal_adc *adc, int chan, bool freerunning)
+{
+    enum adc_positive_input input;
+    int rc;
+
+    if (adc->chan == chan && adc->config.freerunning == freerunning) {
+        return 0;
+    }
+    rc = samd21_adc_input(chan, &input);
+    if (rc) {
+        return rc;
+    }
+    if (adc->module.hw) {
+        adc_reset(&adc->module);
+    }
+    adc->config.positive_input = input;
+    adc->config.freerunning = freerunning;
+    if (adc_init(&adc->module, ADC, &adc->config) != STATUS_OK) {
+        adc->chan = -1;
+        return EIO;
+    }
+    adc->chan = chan;
+    return 0;
+}
+
+static void
+samd21_adc_dma_done(struct dma_resource *resource)
+{
+    struct samd21_hal_adc *adc = &samd21_hal_adc;
+    uint16_t *buf;
+
+    if (resource->job_status != STATUS_OK) {
+        return;
+    }
+    buf = adc->buf[adc->cur];
+    adc->cur ^= 1;
+    if (adc->cb) {
+        adc->cb(adc->cb_arg, buf, adc->cnt);
+    }
+}
+
+int
+samd21_adc_init(const struct samd21_adc_config *pconfig)
+{
+    struct samd21_hal_adc *adc = &samd21_hal_adc;
+    struct dma_resource_config dcfg;
+    uint32_t clk;
+    int presc;
+
+    if (adc->flags & SAMD21_ADC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+
+    adc_get_config_defaults(&adc->config);
+
+    switch (pconfig->volt) {
+    case SAMD21_ADC_REFERENCE_INT1V:
+        adc->config.reference = ADC_REFERENCE_INT1V;
+        break;
+    case SAMD21_ADC_REFERENCE_INTVCC0:
+        adc->config.reference = ADC_REFERENCE_INTVCC0;
+        break;
+    case SAMD21_ADC_REFERENCE_INTVCC1:
+        adc->config.reference = ADC_REFERENCE_INTVCC1;
+        break;
+    case SAMD21_ADC_REFERENCE_AREFA:
+        adc->config.reference = ADC_REFERENCE_AREFA;
+        break;
+    case SAMD21_ADC_REFERENCE_AREFB:
+        adc->config.reference = ADC_REFERENCE_AREFB;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    switch (pconfig->resolution_bits) {
+    case SAMD21_RESOLUTION_8_BITS:
+        adc->config.resolution = ADC_RESOLUTION_8BIT;
+        break;
+    case SAMD21_RESOLUTION_10_BITS:
+        adc->config.resolution = ADC_RESOLUTION_10BIT;
+        break;
+    case SAMD21_RESOLUTION_12_BITS:
+        adc->config.resolution = ADC_RESOLUTION_12BIT;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    switch (pconfig->gain) {
+    case SAMD21_GAIN_DIV2:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_DIV2;
+        break;
+    case SAMD21_GAIN_1X:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_1X;
+        break;
+    case SAMD21_GAIN_2X:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_2X;
+        break;
+    case SAMD21_GAIN_4X:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_4X;
+        break;
+    case SAMD21_GAIN_8X:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_8X;
+        break;
+    case SAMD21_GAIN_16X:
+        adc->config.gain_factor = ADC_GAIN_FACTOR_16X;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    /*
+     * Fastest ADC clock within spec, from GCLK0 (which is the CPU clock).
+     * Prescaler goes from DIV4 to DIV512 in powers of 2.
+     */
+    clk = SystemCoreClock / 4;
+    for (presc = 0; presc < 7 && clk > SAMD21_ADC_MAX_CLK; presc++) {
+        clk >>= 1;
+    }
+    adc->config.clock_prescaler =
+      (enum adc_clock_prescaler)ADC_CTRLB_PRESCALER(presc);
+
+    adc->ref_mv = pconfig->voltage_mvolts;
+    adc->chan = -1;
+
+    if (!(adc->flags & SAMD21_ADC_FLAG_INIT)) {
+        samd21_dma_init();
+
+        dma_get_config_defaults(&dcfg);
+        dcfg.peripheral_trigger = ADC_DMAC_ID_RESRDY;
+        dcfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+        dcfg.priority = DMA_PRIORITY_LEVEL_1;
+        if (dma_allocate(&adc->dma, &dcfg) != STATUS_OK) {
+            return ENOMEM;
+        }
+        dma_register_callback(&adc->dma, samd21_adc_dma_done,
+                              DMA_CALLBACK_TRANSFER_DONE);
+        dma_enable_callback(&adc->dma, DMA_CALLBACK_TRANSFER_DONE);
+        adc->flags |= SAMD21_ADC_FLAG_INIT;
+    }
+    return 0;
+}
+
+int
+samd21_adc_read(enum samd_adc_analog_channel chan, uint16_t *result)
+{
+    struct samd21_hal_adc *adc = &samd21_hal_adc;
+    enum status_code status;
+    int rc;
+
+    if (!(adc->flags & SAMD21_ADC_FLAG_INIT)) {
+        return EINVAL;
+    }
+    if (adc->flags & SAMD21_ADC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+    rc = samd21_adc_setup(adc, chan, false);
+    if (rc) {
+        return rc;
+    }
+    adc_enable(&adc->module);
+    adc_start_conversion(&adc->module);
+    do {
+        status = adc_read(&adc->module, result);
+    } while (status == STATUS_BUSY);
+    adc_disable(&adc->module);
+
+    return status == STATUS_OK ? 0 : EIO;
+}
+
+int
+samd21_adc_get_bits(void)
+{
+    switch (samd21_hal_adc.config.resolution) {
+    case ADC_RESOLUTION_8BIT:
+        return 8;
+    case ADC_RESOLUTION_10BIT:
+        return 10;
+    default:
+        return 12;
+    }
+}
+
+int
+samd21_adc_get_ref_mv(void)
+{
+    return samd21_hal_adc.ref_mv;
+}
+
+int
+samd21_adc_start(enum samd_adc_analog_channel chan,
+                 uint16_t *buf0, uint16_t *buf1, int cnt,
+                 samd21_adc_buf_cb cb, void *arg)
+{
+    struct samd21_hal_adc *adc = &samd21_hal_adc;
+    struct dma_descriptor_config cfg;
+    int rc;
+    int i;
+
+    if (!(adc->flags & SAMD21_ADC_FLAG_INIT) || !buf0 || !buf1 ||
+        cnt <= 0 || cnt > UINT16_MAX) {
+        return EINVAL;
+    }
+    if (adc->flags & SAMD21_ADC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+    rc = samd21_adc_setup(adc, chan, true);
+    if (rc) {
+        return rc;
+    }
+
+    adc->buf[0] = buf0;
+    adc->buf[1] = buf1;
+    adc->cnt = cnt;
+    adc->cur = 0;
+    adc->cb = cb;
+    adc->cb_arg = arg;
+
+    for (i = 0; i < 2; i++) {
+        dma_descriptor_get_config_defaults(&cfg);
+        cfg.beat_size = DMA_BEAT_SIZE_HWORD;
+        cfg.src_increment_enable = false;
+        cfg.block_transfer_count = cnt;
+        cfg.source_address = (uint32_t)&ADC->RESULT.reg;
+        /* destination is the end address when incrementing */
+        cfg.destination_address = (uint32_t)(adc->buf[i] + cnt);
+        cfg.next_descriptor_address = (uint32_t)&adc->dma_desc[i ^ 1];
+        cfg.block_action = DMA_BLOCK_ACTION_INT;
+        dma_descriptor_create(&adc->dma_desc[i], &cfg);
+    }
+    dma_update_descriptor(&adc->dma, &adc->dma_desc[0]);
+
+    if (dma_start_transfer_job(&adc->dma) != STATUS_OK) {
+        return EIO;
+    }
+    adc->flags |= SAMD21_ADC_FLAG_RUNNING;
+
+    /* In free-running mode one start keeps conversions going */
+    adc_enable(&adc->module);
+    adc_start_conversion(&adc->module);
+    return 0;
+}
+
+int
+samd21_adc_stop(void)
+{
+    struct samd21_hal_adc *adc = &samd21_hal_adc;
+
+    if (!(adc->flags & SAMD21_ADC_FLAG_RUNNING)) {
+        return EINVAL;
+    }
+    adc_disable(&adc->module);
+    dma_abort_job(&adc->dma);
+    adc->flags &= ~SAMD21_ADC_FLAG_RUNNING;
+    return 0;
+}
+
+#endif /* MYNEWT_VAL(ADC) */
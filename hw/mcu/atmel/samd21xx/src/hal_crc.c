@@ -0,0 +1,148 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "mcu/hal_crc.h"
+#include "mcu/samd21.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#include "sam0/drivers/dma/dma.h"
+#include "sam0/drivers/dma/dma_crc.h"
+#include "samd21_priv.h"
+
+/*
+ * Data goes through a memory-to-memory transfer with the CRC engine
+ * attached to the channel. Destination is a single word which every beat
+ * overwrites; it's only there because a transfer needs one.
+ */
+#define SAMD21_CRC_MAX_BEATS        (UINT16_MAX)
+
+static struct {
+    struct dma_resource dma;
+    COMPILER_ALIGNED(16) DmacDescriptor desc;
+    uint32_t sink;
+    uint8_t init;
+    uint8_t beat_len;
+} samd21_crc;
+
+int
+samd21_crc_begin(int type, uint32_t seed, int word_beats)
+{
+    struct dma_resource_config dcfg;
+    struct dma_crc_config ccfg;
+    int rc = 0;
+
+    dma_crc_get_config_defaults(&ccfg);
+    ccfg.type = type == SAMD21_CRC_32 ? CRC_TYPE_32 : CRC_TYPE_16;
+    ccfg.size = word_beats ? CRC_BEAT_SIZE_WORD : CRC_BEAT_SIZE_BYTE;
+
+    cpu_irq_enter_critical();
+    if (!samd21_crc.init) {
+        samd21_dma_init();
+
+        dma_get_config_defaults(&dcfg);
+        dcfg.trigger_action = DMA_TRIGGER_ACTON_TRANSACTION;
+        if (dma_allocate(&samd21_crc.dma, &dcfg) != STATUS_OK) {
+            rc = ENOMEM;
+            goto out;
+        }
+        /* No callbacks; these are for job_status to get updated */
+        dma_enable_callback(&samd21_crc.dma, DMA_CALLBACK_TRANSFER_DONE);
+        dma_enable_callback(&samd21_crc.dma, DMA_CALLBACK_TRANSFER_ERROR);
+        samd21_crc.init = 1;
+    }
+    if (DMAC->CTRL.reg & DMAC_CTRL_CRCENABLE ||
+      dma_crc_channel_enable(samd21_crc.dma.channel_id, &ccfg) != STATUS_OK) {
+        rc = EBUSY;
+        goto out;
+    }
+    DMAC->CRCCHKSUM.reg = seed;
+    samd21_crc.beat_len = word_beats ? 4 : 1;
+out:
+    cpu_irq_leave_critical();
+    return rc;
+}
+
+static int
+samd21_crc_run(const uint8_t *src, uint32_t len, int inc)
+{
+    struct dma_descriptor_config cfg;
+    uint32_t beat_len = samd21_crc.beat_len;
+    uint32_t cnt;
+
+    if (len & (beat_len - 1) || (uint32_t)src & (beat_len - 1)) {
+        return EINVAL;
+    }
+    while (len) {
+        cnt = len / beat_len;
+        if (cnt > SAMD21_CRC_MAX_BEATS) {
+            cnt = SAMD21_CRC_MAX_BEATS;
+        }
+
+        dma_descriptor_get_config_defaults(&cfg);
+        cfg.beat_size = beat_len == 4 ? DMA_BEAT_SIZE_WORD : DMA_BEAT_SIZE_BYTE;
+        cfg.src_increment_enable = inc;
+        cfg.dst_increment_enable = false;
+        cfg.block_transfer_count = cnt;
+        /* source is the end address when incrementing */
+        cfg.source_address = (uint32_t)src + (inc ? cnt * beat_len : 0);
+        cfg.destination_address = (uint32_t)&samd21_crc.sink;
+        dma_descriptor_create(&samd21_crc.desc, &cfg);
+        dma_update_descriptor(&samd21_crc.dma, &samd21_crc.desc);
+
+        if (dma_start_transfer_job(&samd21_crc.dma) != STATUS_OK) {
+            return EIO;
+        }
+        dma_trigger_transfer(&samd21_crc.dma);
+        while (dma_get_job_status(&samd21_crc.dma) == STATUS_BUSY) {
+        }
+        if (dma_get_job_status(&samd21_crc.dma) != STATUS_OK) {
+            return EIO;
+        }
+        if (inc) {
+            src += cnt * beat_len;
+        }
+        len -= cnt * beat_len;
+    }
+    return 0;
+}
+
+int
+samd21_crc_update(const void *data, uint32_t len)
+{
+    return samd21_crc_run(data, len, 1);
+}
+
+int
+samd21_crc_fill(const void *data, uint32_t len)
+{
+    return samd21_crc_run(data, len, 0);
+}
+
+uint32_t
+samd21_crc_end(void)
+{
+    uint32_t crc;
+
+    crc = dma_crc_get_checksum();
+    dma_crc_disable();
+    return crc;
+}
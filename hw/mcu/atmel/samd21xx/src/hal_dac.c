@@ -0,0 +1,425 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "syscfg/syscfg.h"
+#include "compiler.h"
+#include "mcu/hal_dac.h"
+#include "mcu/samd21.h"
+#include "mcu/cmsis_nvic.h"
+#include "sam0/drivers/dac/dac.h"
+#include "sam0/drivers/tc/tc.h"
+#include "sam0/drivers/events/events.h"
+#include "sam0/drivers/dma/dma.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#include "samd21_priv.h"
+
+#if MYNEWT_VAL(DAC)
+
+#define SAMD21_DAC_RING_SIZE        MYNEWT_VAL(DAC_RING_SIZE)
+
+#if SAMD21_DAC_RING_SIZE < 2
+#error "DAC_RING_SIZE must be at least 2"
+#endif
+
+#define SAMD21_DAC_BITS             10
+
+#define SAMD21_DAC_FLAG_INIT        (0x1)
+#define SAMD21_DAC_FLAG_RUNNING     (0x2)
+#define SAMD21_DAC_FLAG_STARVED     (0x4)   /* DMA stopped, queue empty */
+
+struct samd21_hal_dac {
+    struct dac_module               module;
+    uint8_t                         flags;
+    int                             ref_mv;
+
+    /*
+     * Streaming. Timer overflow event starts a conversion, which moves
+     * DATABUF to DATA; DMA refills DATABUF when it becomes empty.
+     * Ring descriptors are linked in a loop, and have VALID set only
+     * while they hold a queued buffer. When DMA hits one which isn't
+     * valid, the channel stops, and it's restarted from that descriptor
+     * when the next buffer is queued.
+     */
+    struct tc_module                tc;
+    struct events_resource          ev;
+    struct dma_resource             dma;
+    COMPILER_ALIGNED(16) DmacDescriptor ring[SAMD21_DAC_RING_SIZE];
+    uint8_t                         head;       /* next one to queue */
+    uint8_t                         tail;       /* oldest queued */
+    uint8_t                         cnt;
+    uint8_t                         starve_idx; /* where DMA stopped */
+    samd21_dac_buf_cb               cb;
+    void                           *cb_arg;
+    uint32_t                        underruns;
+};
+
+static struct samd21_hal_dac samd21_hal_dac;
+
+/* Indexed by TC_CTRLA_PRESCALER value */
+static const uint16_t samd21_dac_presc_div[] = {
+    1, 2, 4, 8, 16, 64, 256, 1024
+};
+
+/*
+ * DAC ran out of data at a conversion start event; DMA didn't keep up.
+ */
+static void
+samd21_dac_irq_handler(void)
+{
+    DAC->INTFLAG.reg = DAC_INTFLAG_UNDERRUN;
+    samd21_hal_dac.underruns++;
+}
+
+static void
+samd21_dac_restart(struct samd21_hal_dac *dac)
+{
+    dma_abort_job(&dac->dma);
+    dma_update_descriptor(&dac->dma, &dac->ring[dac->starve_idx]);
+    dma_start_transfer_job(&dac->dma);
+    dac->flags &= ~SAMD21_DAC_FLAG_STARVED;
+
+    DAC->INTFLAG.reg = DAC_INTFLAG_UNDERRUN;
+    DAC->INTENSET.reg = DAC_INTENSET_UNDERRUN;
+}
+
+static void
+samd21_dac_dma_done(struct dma_resource *resource)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    DmacDescriptor *d;
+    const uint16_t *buf;
+    int cnt;
+
+    if (!dac->cnt) {
+        return;
+    }
+    d = &dac->ring[dac->tail];
+    cnt = d->BTCNT.reg;
+    buf = (const uint16_t *)d->SRCADDR.reg - cnt;
+    d->BTCTRL.reg &= ~DMAC_BTCTRL_VALID;
+    if (++dac->tail == SAMD21_DAC_RING_SIZE) {
+        dac->tail = 0;
+    }
+    dac->cnt--;
+
+    if (dac->cb) {
+        dac->cb(dac->cb_arg, buf, cnt);
+    }
+}
+
+/*
+ * Channel stopped at a descriptor which wasn't valid. Write-back
+ * descriptor of the last block has the address of that one.
+ */
+static void
+samd21_dac_dma_starved(struct dma_resource *resource)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    DmacDescriptor *wb;
+
+    if (!(dac->flags & SAMD21_DAC_FLAG_RUNNING)) {
+        return;
+    }
+    wb = (DmacDescriptor *)DMAC->WRBADDR.reg + resource->channel_id;
+    dac->starve_idx = (DmacDescriptor *)wb->DESCADDR.reg - dac->ring;
+    dac->flags |= SAMD21_DAC_FLAG_STARVED;
+    dac->underruns++;
+    DAC->INTENCLR.reg = DAC_INTENCLR_UNDERRUN;
+
+    /* Buffer might have been queued just as the channel stopped */
+    if (dac->ring[dac->starve_idx].BTCTRL.reg & DMAC_BTCTRL_VALID) {
+        samd21_dac_restart(dac);
+    }
+}
+
+int
+samd21_dac_init(const struct samd21_dac_config *pconfig)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    struct dac_config cfg;
+    struct dac_chan_config ccfg;
+    struct dma_resource_config dcfg;
+
+    if (dac->flags & SAMD21_DAC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+
+    dac_get_config_defaults(&cfg);
+    switch (pconfig->reference) {
+    case SAMD_DAC_REFERENCE_INT1V:
+        cfg.reference = DAC_REFERENCE_INT1V;
+        break;
+    case SAMD_DAC_REFERENCE_AVCC:
+        cfg.reference = DAC_REFERENCE_AVCC;
+        break;
+    case SAMD_DAC_REFERENCE_AREF:
+        cfg.reference = DAC_REFERENCE_AREF;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    if (dac->module.hw) {
+        dac_reset(&dac->module);
+    }
+    if (dac_init(&dac->module, DAC, &cfg) != STATUS_OK) {
+        return EIO;
+    }
+    dac_chan_get_config_defaults(&ccfg);
+    dac_chan_set_config(&dac->module, DAC_CHANNEL_0, &ccfg);
+    dac_chan_enable(&dac->module, DAC_CHANNEL_0);
+    dac_enable(&dac->module);
+
+    dac->ref_mv = pconfig->dac_reference_voltage_mvolts;
+
+    if (!(dac->flags & SAMD21_DAC_FLAG_INIT)) {
+        samd21_dma_init();
+
+        dma_get_config_defaults(&dcfg);
+        dcfg.peripheral_trigger = DAC_DMAC_ID_EMPTY;
+        dcfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+        dcfg.priority = DMA_PRIORITY_LEVEL_2;
+        if (dma_allocate(&dac->dma, &dcfg) != STATUS_OK) {
+            return ENOMEM;
+        }
+        dma_register_callback(&dac->dma, samd21_dac_dma_done,
+                              DMA_CALLBACK_TRANSFER_DONE);
+        dma_register_callback(&dac->dma, samd21_dac_dma_starved,
+                              DMA_CALLBACK_TRANSFER_ERROR);
+        dma_register_callback(&dac->dma, samd21_dac_dma_starved,
+                              DMA_CALLBACK_CHANNEL_SUSPEND);
+        dma_enable_callback(&dac->dma, DMA_CALLBACK_TRANSFER_DONE);
+        dma_enable_callback(&dac->dma, DMA_CALLBACK_TRANSFER_ERROR);
+        dma_enable_callback(&dac->dma, DMA_CALLBACK_CHANNEL_SUSPEND);
+
+        NVIC_SetVector(DAC_IRQn, (uint32_t)samd21_dac_irq_handler);
+        NVIC_EnableIRQ(DAC_IRQn);
+        dac->flags |= SAMD21_DAC_FLAG_INIT;
+    }
+    return 0;
+}
+
+int
+samd21_dac_write(uint16_t val)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+
+    if (!(dac->flags & SAMD21_DAC_FLAG_INIT)) {
+        return EINVAL;
+    }
+    if (dac->flags & SAMD21_DAC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+    if (dac_chan_write(&dac->module, DAC_CHANNEL_0, val) != STATUS_OK) {
+        return EIO;
+    }
+    return 0;
+}
+
+int
+samd21_dac_get_bits(void)
+{
+    return SAMD21_DAC_BITS;
+}
+
+int
+samd21_dac_get_ref_mv(void)
+{
+    return samd21_hal_dac.ref_mv;
+}
+
+int
+samd21_dac_start(Tc *tc, uint32_t rate, samd21_dac_buf_cb cb, void *arg)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    struct tc_config tcfg;
+    struct tc_events tev = { 0 };
+    struct events_config ecfg;
+    struct dac_events dev = { 0 };
+    uint32_t cnt;
+    uint8_t gen;
+    int presc;
+
+    if (!(dac->flags & SAMD21_DAC_FLAG_INIT) || rate == 0) {
+        return EINVAL;
+    }
+    if (dac->flags & SAMD21_DAC_FLAG_RUNNING) {
+        return EBUSY;
+    }
+    if (tc == TC3) {
+        gen = EVSYS_ID_GEN_TC3_OVF;
+    } else if (tc == TC4) {
+        gen = EVSYS_ID_GEN_TC4_OVF;
+    } else if (tc == TC5) {
+        gen = EVSYS_ID_GEN_TC5_OVF;
+    } else {
+        return EINVAL;
+    }
+
+    /* Smallest prescaler which gets the period within 16 bits */
+    for (presc = 0; presc < 7; presc++) {
+        if (SystemCoreClock / samd21_dac_presc_div[presc] / rate <=
+            UINT16_MAX + 1) {
+            break;
+        }
+    }
+    cnt = SystemCoreClock / samd21_dac_presc_div[presc] / rate;
+    if (cnt < 2 || cnt > UINT16_MAX + 1) {
+        return EINVAL;
+    }
+
+    tc_get_config_defaults(&tcfg);
+    tcfg.counter_size = TC_COUNTER_SIZE_16BIT;
+    tcfg.clock_prescaler = (enum tc_clock_prescaler)TC_CTRLA_PRESCALER(presc);
+    tcfg.wave_generation = TC_WAVE_GENERATION_MATCH_FREQ;
+    tcfg.counter_16_bit.compare_capture_channel[0] = cnt - 1;
+    if (tc_init(&dac->tc, tc, &tcfg) != STATUS_OK) {
+        return EIO;
+    }
+    tev.generate_event_on_overflow = true;
+    tc_enable_events(&dac->tc, &tev);
+
+    samd21_events_init();
+    events_get_config_defaults(&ecfg);
+    ecfg.generator = gen;
+    ecfg.path = EVENTS_PATH_ASYNCHRONOUS;
+    ecfg.edge_detect = EVENTS_EDGE_DETECT_NONE;
+    if (events_allocate(&dac->ev, &ecfg) != STATUS_OK) {
+        tc_reset(&dac->tc);
+        return ENOMEM;
+    }
+    events_attach_user(&dac->ev, EVSYS_ID_USER_DAC_START);
+
+    dac_disable(&dac->module);
+    dev.on_event_start_conversion = true;
+    dac_enable_events(&dac->module, &dev);
+    dac_enable(&dac->module);
+
+    dac->head = 0;
+    dac->tail = 0;
+    dac->cnt = 0;
+    dac->starve_idx = 0;
+    dac->cb = cb;
+    dac->cb_arg = arg;
+    dac->underruns = 0;
+    dac->flags |= SAMD21_DAC_FLAG_RUNNING | SAMD21_DAC_FLAG_STARVED;
+
+    tc_enable(&dac->tc);
+    return 0;
+}
+
+int
+samd21_dac_queue(const uint16_t *buf, int cnt)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    struct dma_descriptor_config cfg;
+    DmacDescriptor *d;
+    int next;
+
+    if (!buf || cnt <= 0 || cnt > UINT16_MAX) {
+        return EINVAL;
+    }
+
+    cpu_irq_enter_critical();
+    if (!(dac->flags & SAMD21_DAC_FLAG_RUNNING)) {
+        cpu_irq_leave_critical();
+        return EINVAL;
+    }
+    if (dac->cnt == SAMD21_DAC_RING_SIZE) {
+        cpu_irq_leave_critical();
+        return EAGAIN;
+    }
+
+    next = dac->head + 1;
+    if (next == SAMD21_DAC_RING_SIZE) {
+        next = 0;
+    }
+    d = &dac->ring[dac->head];
+
+    /*
+     * DMA might be fetching this descriptor right now; only mark it
+     * valid once everything else is in place.
+     */
+    dma_descriptor_get_config_defaults(&cfg);
+    cfg.descriptor_valid = false;
+    cfg.beat_size = DMA_BEAT_SIZE_HWORD;
+    cfg.dst_increment_enable = false;
+    cfg.block_transfer_count = cnt;
+    /* source is the end address when incrementing */
+    cfg.source_address = (uint32_t)(buf + cnt);
+    cfg.destination_address = (uint32_t)&DAC->DATABUF.reg;
+    cfg.next_descriptor_address = (uint32_t)&dac->ring[next];
+    cfg.block_action = DMA_BLOCK_ACTION_INT;
+    dma_descriptor_create(d, &cfg);
+    __DMB();
+    d->BTCTRL.reg |= DMAC_BTCTRL_VALID;
+
+    dac->head = next;
+    dac->cnt++;
+
+    if (dac->flags & SAMD21_DAC_FLAG_STARVED) {
+        samd21_dac_restart(dac);
+    }
+    cpu_irq_leave_critical();
+    return 0;
+}
+
+int
+samd21_dac_stop(void)
+{
+    struct samd21_hal_dac *dac = &samd21_hal_dac;
+    struct dac_events dev = { 0 };
+    int i;
+
+    if (!(dac->flags & SAMD21_DAC_FLAG_RUNNING)) {
+        return EINVAL;
+    }
+    dac->flags &= ~(SAMD21_DAC_FLAG_RUNNING | SAMD21_DAC_FLAG_STARVED);
+
+    tc_reset(&dac->tc);
+    dma_abort_job(&dac->dma);
+    DAC->INTENCLR.reg = DAC_INTENCLR_UNDERRUN;
+
+    events_detach_user(&dac->ev, EVSYS_ID_USER_DAC_START);
+    events_release(&dac->ev);
+
+    dac_disable(&dac->module);
+    dev.on_event_start_conversion = true;
+    dac_disable_events(&dac->module, &dev);
+    dac_enable(&dac->module);
+
+    /* Buffers still queued are dropped */
+    for (i = 0; i < SAMD21_DAC_RING_SIZE; i++) {
+        dac->ring[i].BTCTRL.reg &= ~DMAC_BTCTRL_VALID;
+    }
+    dac->cnt = 0;
+    return 0;
+}
+
+uint32_t
+samd21_dac_underruns(void)
+{
+    return samd21_hal_dac.underruns;
+}
+
+#endif /* MYNEWT_VAL(DAC) */
@@ -22,8 +22,18 @@
  */
 #include <string.h>
 #include <assert.h>
+#include "syscfg/syscfg.h"
 #include <hal/hal_flash_int.h>
+#include <mcu/samd21.h>
+#include <mcu/hal_flash.h>
 #include <nvm.h>
+#if MYNEWT_VAL(FLASH_ASYNC)
+#include "mcu/cmsis_nvic.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#endif
+#if MYNEWT_VAL(FLASH_DMA_CRC)
+#include <mcu/hal_crc.h>
+#endif
 
 
 #define SAMD21_FLASH_START_ADDR         (0x0)
@@ -38,6 +48,73 @@
 
 #define SAMD21_FLASH_PAGES_PER_SECTOR   (SAMD21_FLASH_PAGES_PER_ROW*SAMD21_FLASH_ROWS_PER_SECTOR)
 
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+/*
+ * Writes are collected into the NVM page buffer, and the page is written
+ * only when all of it has been filled, when a write goes to a different
+ * page, or on samd21_flash_flush(). Page buffer can't be read back, so
+ * we keep a copy of it here.
+ */
+#define SAMD21_FLASH_WC_NONE            (0xffffffff)
+#define SAMD21_NVM_MEMORY               ((volatile uint16_t *)FLASH_ADDR)
+
+static struct {
+    uint32_t page;              /* address of buffered page */
+    uint64_t written;           /* bitmap of bytes written in page */
+    uint8_t data[NVMCTRL_PAGE_SIZE];
+} samd21_flash_wc = {
+    .page = SAMD21_FLASH_WC_NONE
+};
+#endif
+
+#if MYNEWT_VAL(FLASH_ASYNC) && !MYNEWT_VAL(FLASH_WRITE_COMBINE)
+#define SAMD21_NVM_MEMORY               ((volatile uint16_t *)FLASH_ADDR)
+#endif
+
+#if MYNEWT_VAL(FLASH_ASYNC)
+static STAILQ_HEAD(, samd21_flash_op) samd21_flash_q =
+    STAILQ_HEAD_INITIALIZER(samd21_flash_q);
+
+/* CTRLB setting to restore when queue becomes empty */
+static uint32_t samd21_flash_ctrlb;
+
+/* Tasks waiting for queue to empty; released from interrupt handler */
+static struct os_sem samd21_flash_sem;
+static uint8_t samd21_flash_waiting;
+
+/*
+ * READY interrupt is enabled for as long as there are queued operations.
+ * Before OS has started, sleep until an interrupt; WFI wakes up on a
+ * pending one even inside the critical section, so none is missed.
+ */
+static void
+samd21_flash_async_wait(void)
+{
+    int sr;
+
+    while (1) {
+        OS_ENTER_CRITICAL(sr);
+        if (!(NVMCTRL->INTENSET.reg & NVMCTRL_INTENSET_READY)) {
+            OS_EXIT_CRITICAL(sr);
+            return;
+        }
+        if (!os_started()) {
+            __WFI();
+            OS_EXIT_CRITICAL(sr);
+            continue;
+        }
+        samd21_flash_waiting++;
+        OS_EXIT_CRITICAL(sr);
+        os_sem_pend(&samd21_flash_sem, OS_TIMEOUT_NEVER);
+    }
+}
+#else
+static inline void
+samd21_flash_async_wait(void)
+{
+}
+#endif
+
 static int samd21_flash_read(const struct hal_flash *dev, uint32_t address,
         void *dst, uint32_t num_bytes);
 static int samd21_flash_write(const struct hal_flash *dev, uint32_t address,
@@ -61,51 +138,268 @@ struct hal_flash samd21_flash_dev = {
     .hf_itf = &samd21_flash_funcs,
 };
 
+/*
+ * Flash is memory mapped, so reads are plain copies. Word at a time
+ * when source and destination are equally aligned.
+ */
+static void
+samd21_flash_copy(uint8_t *dst, const uint8_t *src, uint32_t num_bytes)
+{
+    uint32_t *wdst;
+    const uint32_t *wsrc;
+
+    if ((((uint32_t)dst ^ (uint32_t)src) & 3) == 0) {
+        while (((uint32_t)src & 3) && num_bytes) {
+            *dst++ = *src++;
+            num_bytes--;
+        }
+        wdst = (uint32_t *)dst;
+        wsrc = (const uint32_t *)src;
+        while (num_bytes >= 4) {
+            *wdst++ = *wsrc++;
+            num_bytes -= 4;
+        }
+        dst = (uint8_t *)wdst;
+        src = (const uint8_t *)wsrc;
+    }
+    while (num_bytes--) {
+        *dst++ = *src++;
+    }
+}
+
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+/*
+ * Data in page buffer is what that page will contain once written.
+ */
+static void
+samd21_flash_wc_merge(uint32_t address, uint8_t *dst, uint32_t num_bytes)
+{
+    uint32_t page = samd21_flash_wc.page;
+    uint32_t start;
+    uint32_t end;
+
+    if (page == SAMD21_FLASH_WC_NONE) {
+        return;
+    }
+    start = address > page ? address : page;
+    end = address + num_bytes;
+    if (end > page + NVMCTRL_PAGE_SIZE) {
+        end = page + NVMCTRL_PAGE_SIZE;
+    }
+    for (; start < end; start++) {
+        dst[start - address] &= samd21_flash_wc.data[start - page];
+    }
+}
+
+static int
+samd21_flash_wc_commit(void)
+{
+    uint32_t page = samd21_flash_wc.page;
+
+    if (page == SAMD21_FLASH_WC_NONE) {
+        return 0;
+    }
+    samd21_flash_wc.page = SAMD21_FLASH_WC_NONE;
+    if (nvm_execute_command(NVM_COMMAND_WRITE_PAGE, page, 0) != STATUS_OK ||
+      nvm_get_error() != NVM_ERROR_NONE) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+samd21_flash_flush(void)
+{
+    samd21_flash_async_wait();
+    return samd21_flash_wc_commit();
+}
+#else
+int
+samd21_flash_flush(void)
+{
+    return 0;
+}
+#endif
+
 static int
 samd21_flash_read(const struct hal_flash *dev, uint32_t address,
         void *dst, uint32_t num_bytes)
 {
-    int base_address;
-    int offset;
-    struct nvm_parameters params;
-    uint8_t page_buffer[64];
-    uint8_t *pdst = dst;
+    samd21_flash_copy(dst, (const uint8_t *)address, num_bytes);
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+    samd21_flash_wc_merge(address, dst, num_bytes);
+#endif
+    return 0;
+}
 
-    /* make sure this fits into our stack buffer  */
-    nvm_get_parameters(&params);
-    assert(params.page_size <= sizeof(page_buffer));
+const void *
+samd21_flash_ptr(uint32_t address, uint32_t len)
+{
+    if (address < SAMD21_FLASH_START_ADDR ||
+      address - SAMD21_FLASH_START_ADDR > samd21_flash_dev.hf_size ||
+      len > samd21_flash_dev.hf_size - (address - SAMD21_FLASH_START_ADDR)) {
+        return NULL;
+    }
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+    if (samd21_flash_wc.page != SAMD21_FLASH_WC_NONE &&
+      samd21_flash_wc.page < address + len &&
+      samd21_flash_wc.page + NVMCTRL_PAGE_SIZE > address) {
+        if (samd21_flash_wc_commit()) {
+            return NULL;
+        }
+    }
+#endif
+    return (const void *)address;
+}
 
-    /* get the page address (this is not a sector, there are 4 pages per
-     * row */
-    while(num_bytes) {
-        int read_len;
+#if MYNEWT_VAL(FLASH_DMA_CRC)
+/*
+ * Runs the range through the DMAC CRC engine. Beats are words when
+ * address and length allow it.
+ */
+int
+samd21_flash_crc32(uint32_t address, uint32_t len, uint32_t *crc)
+{
+    const uint8_t *src;
+    int word;
+    int rc;
 
-        base_address = address & ~(params.page_size - 1);
+    samd21_flash_async_wait();
+    src = samd21_flash_ptr(address, len);
+    if (!src) {
+        return -1;
+    }
+    word = ((((uint32_t)src & 3) | (len & 3)) == 0);
+    if (samd21_crc_begin(SAMD21_CRC_32, 0xffffffff, word)) {
+        return -1;
+    }
+    rc = samd21_crc_update(src, len);
+    /* Engine bit reverses and complements the CRC32 result on readout */
+    *crc = samd21_crc_end();
+    return rc ? -1 : 0;
+}
+#endif
 
-        offset = address - base_address;
-        read_len = params.page_size - offset;
+/*
+ * Direct compare against 0xff, a word at a time where aligned.
+ */
+static int
+samd21_flash_erased(const uint8_t *src, uint32_t len)
+{
+    const uint32_t *word;
 
-        if(read_len > num_bytes) {
-            read_len = num_bytes;
+    while (len && ((uint32_t)src & 3)) {
+        if (*src++ != 0xff) {
+            return 0;
+        }
+        len--;
+    }
+    for (word = (const uint32_t *)src; len >= 4; len -= 4) {
+        if (*word++ != 0xffffffff) {
+            return 0;
+        }
+    }
+    for (src = (const uint8_t *)word; len; len--) {
+        if (*src++ != 0xff) {
+            return 0;
         }
+    }
+    return 1;
+}
 
-        if(nvm_read_buffer(base_address, page_buffer, params.page_size)
-                        != STATUS_OK) {
-            return -1;
+int
+samd21_flash_is_blank(uint32_t address, uint32_t len)
+{
+    const uint8_t *src;
+
+    samd21_flash_async_wait();
+    src = samd21_flash_ptr(address, len);
+    if (!src) {
+        return -1;
+    }
+    return samd21_flash_erased(src, len);
+}
+
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+static int
+samd21_flash_write(const struct hal_flash *dev, uint32_t address,
+        const void *src, uint32_t len)
+{
+    const uint8_t *psrc = src;
+    const uint8_t *flash;
+    uint32_t page;
+    uint32_t offset;
+    uint32_t write_len;
+    uint32_t i;
+
+    samd21_flash_async_wait();
+
+    while (len) {
+        page = address & ~(NVMCTRL_PAGE_SIZE - 1);
+        offset = address - page;
+        write_len = NVMCTRL_PAGE_SIZE - offset;
+        if (write_len > len) {
+            write_len = len;
+        }
+
+        if (page != samd21_flash_wc.page) {
+            if (samd21_flash_wc_commit()) {
+                return -1;
+            }
         }
 
-        /* move the pointers since this is a sure thing now */
-        num_bytes -= read_len;
-        address += read_len;
+        /*
+         * Cannot write to non-erased location. This includes bytes which
+         * are in page buffer, but not written yet.
+         */
+        flash = (const uint8_t *)address;
+        for (i = 0; i < write_len; i++) {
+            if (flash[i] != 0xff) {
+                return -1;
+            }
+        }
+        if (page == samd21_flash_wc.page) {
+            for (i = offset; i < offset + write_len; i++) {
+                if (samd21_flash_wc.written & (1ULL << i)) {
+                    return -1;
+                }
+            }
+        } else {
+            if (nvm_execute_command(NVM_COMMAND_PAGE_BUFFER_CLEAR, page, 0) !=
+              STATUS_OK) {
+                return -1;
+            }
+            memset(samd21_flash_wc.data, 0xff, sizeof(samd21_flash_wc.data));
+            samd21_flash_wc.written = 0;
+            samd21_flash_wc.page = page;
+        }
 
-        /* copy it into the page buffer */
-        while(read_len--) {
-             *pdst++ = page_buffer[offset++];
+        memcpy(&samd21_flash_wc.data[offset], psrc, write_len);
+        if (write_len == NVMCTRL_PAGE_SIZE) {
+            samd21_flash_wc.written = ~0ULL;
+        } else {
+            samd21_flash_wc.written |= ((1ULL << write_len) - 1) << offset;
+        }
+
+        /* Page buffer must be written 16 bits at a time */
+        for (i = offset & ~1; i < offset + write_len; i += 2) {
+            SAMD21_NVM_MEMORY[(page + i) / 2] = samd21_flash_wc.data[i] |
+              (samd21_flash_wc.data[i + 1] << 8);
+        }
+
+        len -= write_len;
+        address += write_len;
+        psrc += write_len;
+
+        if (samd21_flash_wc.written == ~0ULL) {
+            if (samd21_flash_wc_commit()) {
+                return -1;
+            }
         }
     }
     return 0;
 }
-
+#else
 static int
 samd21_flash_write(const struct hal_flash *dev, uint32_t address,
         const void *src, uint32_t len)
@@ -116,6 +410,8 @@ samd21_flash_write(const struct hal_flash *dev, uint32_t address,
     uint8_t page_buffer[64];
     const uint8_t *psrc = src;
 
+    samd21_flash_async_wait();
+
     /* make sure this fits into our stack buffer  */
     nvm_get_parameters(&params);
     assert(params.page_size <= sizeof(page_buffer));
@@ -165,6 +461,7 @@ samd21_flash_write(const struct hal_flash *dev, uint32_t address,
     }
     return 0;
 }
+#endif
 
 static int
 samd21_flash_erase_sector(const struct hal_flash *dev, uint32_t sector_address)
@@ -173,12 +470,24 @@ samd21_flash_erase_sector(const struct hal_flash *dev, uint32_t sector_address)
     int rc;
     int i;
 
+    samd21_flash_async_wait();
     nvm_get_parameters(&params);
 
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+    if (samd21_flash_wc_commit()) {
+        return -1;
+    }
+#endif
+
     /* erase all rows in the sector */
     for(i = 0; i < SAMD21_FLASH_ROWS_PER_SECTOR; i++) {
         uint32_t row_address = sector_address +
                 i*SAMD21_FLASH_PAGES_PER_ROW*params.page_size;
+        /* Erase is slow and wears flash; skip rows which are still erased */
+        if (samd21_flash_erased((const uint8_t *)row_address,
+            SAMD21_FLASH_PAGES_PER_ROW*params.page_size)) {
+            continue;
+        }
         rc = nvm_erase_row(row_address);
         if(rc != STATUS_OK) {
             return -1;
@@ -209,6 +518,193 @@ samd21_flash_sector_info(const struct hal_flash *dev, int idx,
     return 0;
 }
 
+#if MYNEWT_VAL(FLASH_ASYNC)
+static void
+samd21_flash_cmd(uint32_t cmd, uint32_t address)
+{
+    NVMCTRL->STATUS.reg = NVMCTRL_STATUS_MASK;
+    NVMCTRL->ADDR.reg = address / 2;
+    NVMCTRL->CTRLA.reg = cmd | NVMCTRL_CTRLA_CMDEX_KEY;
+}
+
+/*
+ * Issues command for the next row/page of op. Returns 1 if one was
+ * started, 0 if op is complete, -1 on error. Page write takes two steps:
+ * page buffer is cleared first, and loaded and written on the next
+ * READY interrupt.
+ */
+static int
+samd21_flash_op_step(struct samd21_flash_op *op)
+{
+    const uint8_t *flash;
+    const uint8_t *src;
+    uint32_t address;
+    uint32_t page;
+    uint32_t offset;
+    uint32_t cnt;
+    uint32_t i;
+    uint16_t val;
+
+    if (op->sfo_off >= op->sfo_len) {
+        return 0;
+    }
+    address = op->sfo_addr + op->sfo_off;
+    if (!op->sfo_src) {
+        samd21_flash_cmd(NVM_COMMAND_ERASE_ROW, address);
+        op->sfo_off += NVMCTRL_ROW_SIZE;
+        return 1;
+    }
+
+    page = address & ~(NVMCTRL_PAGE_SIZE - 1);
+    offset = address - page;
+    cnt = NVMCTRL_PAGE_SIZE - offset;
+    if (cnt > op->sfo_len - op->sfo_off) {
+        cnt = op->sfo_len - op->sfo_off;
+    }
+    src = op->sfo_src + op->sfo_off;
+
+    if (!op->sfo_pbc) {
+        /* Cannot write to non-erased location */
+        flash = (const uint8_t *)address;
+        for (i = 0; i < cnt; i++) {
+            if (flash[i] != 0xff) {
+                return -1;
+            }
+        }
+        samd21_flash_cmd(NVM_COMMAND_PAGE_BUFFER_CLEAR, page);
+        op->sfo_pbc = 1;
+        return 1;
+    }
+    op->sfo_pbc = 0;
+
+    /*
+     * Page buffer is loaded 16 bits at a time. Bytes outside the range
+     * are left 0xff, which doesn't change what is in flash.
+     */
+    for (i = offset & ~1; i < offset + cnt; i += 2) {
+        val = 0xffff;
+        if (i >= offset) {
+            val = (val & 0xff00) | src[i - offset];
+        }
+        if (i + 1 < offset + cnt) {
+            val = (val & 0x00ff) | (src[i + 1 - offset] << 8);
+        }
+        SAMD21_NVM_MEMORY[(page + i) / 2] = val;
+    }
+    samd21_flash_cmd(NVM_COMMAND_WRITE_PAGE, page);
+    op->sfo_off += cnt;
+    return 1;
+}
+
+/*
+ * Queue is empty; stop READY interrupts, and wake up blocking callers.
+ */
+static void
+samd21_flash_idle(void)
+{
+    NVMCTRL->INTENCLR.reg = NVMCTRL_INTENCLR_READY;
+    while (samd21_flash_waiting) {
+        samd21_flash_waiting--;
+        os_sem_release(&samd21_flash_sem);
+    }
+}
+
+/*
+ * NVM controller finished previous command; start the next one.
+ */
+static void
+samd21_flash_irq_handler(void)
+{
+    struct samd21_flash_op *op;
+    int rc;
+
+    op = STAILQ_FIRST(&samd21_flash_q);
+    if (!op) {
+        samd21_flash_idle();
+        return;
+    }
+    if (NVMCTRL->STATUS.reg &
+      (NVMCTRL_STATUS_PROGE | NVMCTRL_STATUS_LOCKE | NVMCTRL_STATUS_NVME)) {
+        rc = -1;
+    } else {
+        rc = samd21_flash_op_step(op);
+    }
+    while (rc <= 0) {
+        STAILQ_REMOVE_HEAD(&samd21_flash_q, sfo_next);
+        op->sfo_rc = rc;
+        os_eventq_put(op->sfo_evq, &op->sfo_ev);
+
+        op = STAILQ_FIRST(&samd21_flash_q);
+        if (!op) {
+            NVMCTRL->CTRLB.reg = samd21_flash_ctrlb;
+            samd21_flash_idle();
+            return;
+        }
+        rc = samd21_flash_op_step(op);
+    }
+}
+
+static int
+samd21_flash_submit(struct samd21_flash_op *op)
+{
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+    if (samd21_flash_wc.page != SAMD21_FLASH_WC_NONE) {
+        if (samd21_flash_flush()) {
+            return -1;
+        }
+    }
+#endif
+    op->sfo_off = 0;
+    op->sfo_rc = 0;
+    op->sfo_pbc = 0;
+
+    cpu_irq_enter_critical();
+    if (STAILQ_EMPTY(&samd21_flash_q)) {
+        /*
+         * Cache off while NVM is busy, like ASF does for its commands.
+         * Manual page write, so that loading the last word of page buffer
+         * doesn't start a write on its own. Controller is idle, so READY
+         * interrupt fires right away and starts the first command.
+         */
+        samd21_flash_ctrlb = NVMCTRL->CTRLB.reg;
+        NVMCTRL->CTRLB.reg = samd21_flash_ctrlb | NVMCTRL_CTRLB_CACHEDIS |
+          NVMCTRL_CTRLB_MANW;
+        NVMCTRL->STATUS.reg = NVMCTRL_STATUS_MASK;
+        NVMCTRL->INTENSET.reg = NVMCTRL_INTENSET_READY;
+    }
+    STAILQ_INSERT_TAIL(&samd21_flash_q, op, sfo_next);
+    cpu_irq_leave_critical();
+    return 0;
+}
+
+int
+samd21_flash_erase_async(struct samd21_flash_op *op, uint32_t address,
+                         uint32_t len)
+{
+    if ((address | len) & (NVMCTRL_ROW_SIZE - 1) || !len ||
+      !samd21_flash_ptr(address, len)) {
+        return -1;
+    }
+    op->sfo_addr = address;
+    op->sfo_len = len;
+    op->sfo_src = NULL;
+    return samd21_flash_submit(op);
+}
+
+int
+samd21_flash_write_async(struct samd21_flash_op *op, uint32_t address,
+                         const void *src, uint32_t len)
+{
+    if (!src || !len || !samd21_flash_ptr(address, len)) {
+        return -1;
+    }
+    op->sfo_addr = address;
+    op->sfo_len = len;
+    op->sfo_src = src;
+    return samd21_flash_submit(op);
+}
+#endif
+
 static int
 samd21_flash_init(const struct hal_flash *dev)
 {
@@ -217,7 +713,11 @@ samd21_flash_init(const struct hal_flash *dev)
     struct nvm_parameters params;
     nvm_get_config_defaults(&cfg);
 
+#if MYNEWT_VAL(FLASH_WRITE_COMBINE)
+    cfg.manual_page_write = true;
+#else
     cfg.manual_page_write = false;
+#endif
     rc = nvm_set_config(&cfg);
     if(rc != STATUS_OK) {
         return -1;
@@ -237,5 +737,11 @@ samd21_flash_init(const struct hal_flash *dev)
     samd21_flash_dev.hf_align = 1;
     samd21_flash_dev.hf_erased_val = 0xff;
 
+#if MYNEWT_VAL(FLASH_ASYNC)
+    os_sem_init(&samd21_flash_sem, 0);
+    NVIC_SetVector(NVMCTRL_IRQn, (uint32_t)samd21_flash_irq_handler);
+    NVIC_EnableIRQ(NVMCTRL_IRQn);
+#endif
+
     return 0;
 }
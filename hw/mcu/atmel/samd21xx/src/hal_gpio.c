@@ -15,13 +15,20 @@
  */
 
 #include "hal/hal_gpio.h"
+#include "syscfg/syscfg.h"
 
 #include <mcu/cmsis_nvic.h>
+#include <mcu/hal_gpio.h>
 
 #include <assert.h>
 #include <compiler.h>
 #include "port.h"
 #include "extint.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+
+#if MYNEWT_VAL(GPIO_IRQ_TIMESTAMP)
+#include <os/os_cputime.h>
+#endif
 
  /* XXX: Notes
  * 4) The code probably does not handle "re-purposing" gpio very well.
@@ -148,6 +155,10 @@ struct gpio_irq {
     void *arg;
 } hal_gpio_irqs[EIC_NUMBER_OF_INTERRUPTS];
 
+#if MYNEWT_VAL(GPIO_IRQ_TIMESTAMP)
+static volatile uint32_t hal_gpio_irq_ts[EIC_NUMBER_OF_INTERRUPTS];
+#endif
+
 int
 hal_gpio_init_out(int pin, int val)
 {
@@ -247,11 +258,7 @@ hal_gpio_read(int pin)
 void
 hal_gpio_write(int pin, int val)
 {
-    if (val) {
-        port_pin_set_output_level(pin, true);
-    } else {
-        port_pin_set_output_level(pin, false);
-    }
+    samd21_gpio_fast_write(pin, val);
 }
 
 /**
@@ -263,11 +270,11 @@ hal_gpio_write(int pin, int val)
  */
 int hal_gpio_toggle(int pin)
 {
-    int pin_state;
+    samd21_gpio_fast_toggle(pin);
 
-    pin_state = (hal_gpio_read(pin) == 0);
-    hal_gpio_write(pin, pin_state);
-    return hal_gpio_read(pin);
+    /* IN would lag behind through the input synchronizer */
+    return !!(PORT_IOBUS->Group[SAMD21_GPIO_PORT(pin)].OUT.reg &
+              SAMD21_GPIO_MASK(pin));
 }
 
 /*
@@ -276,16 +283,30 @@ int hal_gpio_toggle(int pin)
 static void
 hal_gpio_irq(void)
 {
-    int i;
     struct gpio_irq *irq;
-
-    for (i = 0; i < EIC_NUMBER_OF_INTERRUPTS; i++) {
-        if (extint_chan_is_detected(i)) {
-            extint_chan_clear_detected(i);
-            irq = &hal_gpio_irqs[i];
-            if (irq->func) {
-                irq->func(irq->arg);
-            }
+    uint32_t flags;
+    int i;
+#if MYNEWT_VAL(GPIO_IRQ_TIMESTAMP)
+    uint32_t now = os_cputime_get32();
+#endif
+
+    /*
+     * Only channels with interrupt enabled; flags of disabled ones are
+     * left alone. All are cleared with one write before handlers run, so
+     * an edge arriving during a handler interrupts again.
+     */
+    flags = EIC->INTFLAG.reg & EIC->INTENSET.reg;
+    EIC->INTFLAG.reg = flags;
+
+    while (flags) {
+        i = __builtin_ctz(flags);
+        flags &= flags - 1;
+#if MYNEWT_VAL(GPIO_IRQ_TIMESTAMP)
+        hal_gpio_irq_ts[i] = now;
+#endif
+        irq = &hal_gpio_irqs[i];
+        if (irq->func) {
+            irq->func(irq->arg);
         }
     }
 }
@@ -458,3 +479,31 @@ hal_gpio_irq_disable(int pin)
     }
     extint_chan_disable_callback(eic, EXTINT_CALLBACK_TYPE_DETECT);
 }
+
+uint32_t
+samd21_gpio_irq_timestamp(int pin)
+{
+#if MYNEWT_VAL(GPIO_IRQ_TIMESTAMP)
+    int8_t eic;
+
+    eic = hal_gpio_irq_eic(pin);
+    if (eic < 0) {
+        return 0;
+    }
+    return hal_gpio_irq_ts[eic];
+#else
+    return 0;
+#endif
+}
+
+void
+samd21_gpio_sample_cont(int port, uint32_t mask, int enable)
+{
+    cpu_irq_enter_critical();
+    if (enable) {
+        PORT->Group[port].CTRL.reg |= mask;
+    } else {
+        PORT->Group[port].CTRL.reg &= ~mask;
+    }
+    cpu_irq_leave_critical();
+}
@@ -20,6 +20,15 @@
 #include "compiler.h"
 #include "port.h"
 #include "i2c_master.h"
+#if MYNEWT_VAL(I2C_ASYNC)
+#include "os/os.h"
+#include "i2c_master_interrupt.h"
+#endif
+#if MYNEWT_VAL(I2C_DMA)
+#include "sercom_interrupt.h"
+#include "sam0/drivers/dma/dma.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#endif
 
 #include "hal/hal_i2c.h"
 #include "mcu/hal_i2c.h"
@@ -27,15 +36,45 @@
 #include "samd21_priv.h"
 
 /*
- * XXX Timeout value parameter in functions is not used, because Atmel's
- * SDK for i2c internally times out much faster than one OS tick takes.
+ * Without I2C_ASYNC, timeout value parameter in functions is not used,
+ * because Atmel's SDK for i2c internally times out much faster than one
+ * OS tick takes. With it, transfers from tasks are interrupt driven, and
+ * the caller sleeps until completion or timeout. Bus is owned by one
+ * task at a time; others queue on the mutex. Owner keeps the bus across
+ * operations without stop, until last_op or an error.
  */
 struct samd21_i2c_state {
     struct i2c_master_module        module;
     const struct samd21_i2c_config *pconfig;
     Sercom *hw;
+#if MYNEWT_VAL(I2C_ASYNC)
+    struct os_mutex bus_mutex;
+    struct os_sem done_sem;
+#endif
+    struct samd21_i2c_stats stats;
+#if MYNEWT_VAL(I2C_DMA)
+    /*
+     * samd21_i2c_read_reg(). Register address is written polled, then
+     * DMA reads all but the last byte; SERCOM ACKs each one as DMA reads
+     * DATA (smart mode). Last byte is NACKed and followed by stop from
+     * the SERCOM interrupt.
+     */
+    struct dma_resource dma;
+    COMPILER_ALIGNED(16) DmacDescriptor dma_desc;
+    volatile uint8_t dma_state;
+    uint8_t dma_ok;
+    uint8_t *dma_buf;
+    uint16_t dma_len;
+    uint16_t dma_bytes;
+    samd21_i2c_done_t dma_cb;
+    void *dma_cb_arg;
+#endif
 };
 
+#define SAMD21_I2C_DMA_IDLE     (0)
+#define SAMD21_I2C_DMA_RUN      (1)
+#define SAMD21_I2C_DMA_FINISH   (2)
+
 #define HAL_SAMD21_I2C_MAX (6)
 
 #if MYNEWT_VAL(I2C_0)
@@ -98,13 +137,116 @@ struct samd21_i2c_state *samd21_hal_i2cs[HAL_SAMD21_I2C_MAX] =
     }                                                                   \
     (__v) = samd21_hal_i2cs[(__n)];
 
+static void
+samd21_i2c_stats_update(struct samd21_i2c_state *i2c,
+                        enum status_code status, uint32_t bytes)
+{
+    switch (status) {
+    case STATUS_OK:
+        i2c->stats.sis_bytes += bytes;
+        break;
+    case STATUS_ERR_BAD_ADDRESS:
+    case STATUS_ERR_OVERFLOW:
+        i2c->stats.sis_nacks++;
+        break;
+    case STATUS_ERR_PACKET_COLLISION:
+        i2c->stats.sis_arb_lost++;
+        break;
+    case STATUS_ERR_TIMEOUT:
+        i2c->stats.sis_timeouts++;
+        break;
+    case STATUS_BUSY:
+        /* Bus was in use by samd21_i2c_read_reg(); nothing was sent */
+        break;
+    default:
+        i2c->stats.sis_bus_errors++;
+        break;
+    }
+}
+
+
+#if MYNEWT_VAL(I2C_ASYNC)
+static void
+samd21_i2c_job_done(struct i2c_master_module *const module)
+{
+    struct samd21_i2c_state *i2c = (struct samd21_i2c_state *)module;
+
+    os_sem_release(&i2c->done_sem);
+}
+#endif
+
+static int
+samd21_i2c_config(struct samd21_i2c_state *i2c)
+{
+    struct i2c_master_config cfg;
+    enum status_code status;
+
+    i2c_master_get_config_defaults(&cfg);
+    cfg.pinmux_pad0 = i2c->pconfig->pad0_pinmux;
+    cfg.pinmux_pad1 = i2c->pconfig->pad1_pinmux;
+
+    status = i2c_master_init(&i2c->module, i2c->hw, &cfg);
+    if (status != STATUS_OK) {
+        return (int) status;
+    }
+
+#if MYNEWT_VAL(I2C_ASYNC)
+    i2c_master_register_callback(&i2c->module, samd21_i2c_job_done,
+                                 I2C_MASTER_CALLBACK_WRITE_COMPLETE);
+    i2c_master_register_callback(&i2c->module, samd21_i2c_job_done,
+                                 I2C_MASTER_CALLBACK_READ_COMPLETE);
+    i2c_master_register_callback(&i2c->module, samd21_i2c_job_done,
+                                 I2C_MASTER_CALLBACK_ERROR);
+    i2c_master_enable_callback(&i2c->module,
+                               I2C_MASTER_CALLBACK_WRITE_COMPLETE);
+    i2c_master_enable_callback(&i2c->module,
+                               I2C_MASTER_CALLBACK_READ_COMPLETE);
+    i2c_master_enable_callback(&i2c->module, I2C_MASTER_CALLBACK_ERROR);
+#endif
+
+    i2c_master_enable(&i2c->module);
+
+    return 0;
+}
+
+#if MYNEWT_VAL(I2C_DMA)
+static void samd21_i2c_dma_done(struct dma_resource *resource);
+
+/*
+ * Grab a DMA channel for reads. If there aren't any left, bus works
+ * without samd21_i2c_read_reg().
+ */
+static void
+samd21_i2c_dma_init(struct samd21_i2c_state *i2c, int i2c_num)
+{
+    struct dma_resource_config cfg;
+
+    if (i2c->dma_ok) {
+        return;
+    }
+
+    samd21_dma_init();
+
+    dma_get_config_defaults(&cfg);
+    cfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+    cfg.peripheral_trigger = SERCOM0_DMAC_ID_RX + 2 * i2c_num;
+    if (dma_allocate(&i2c->dma, &cfg) != STATUS_OK) {
+        return;
+    }
+    dma_register_callback(&i2c->dma, samd21_i2c_dma_done,
+                          DMA_CALLBACK_TRANSFER_DONE);
+    dma_register_callback(&i2c->dma, samd21_i2c_dma_done,
+                          DMA_CALLBACK_TRANSFER_ERROR);
+    dma_enable_callback(&i2c->dma, DMA_CALLBACK_TRANSFER_DONE);
+    dma_enable_callback(&i2c->dma, DMA_CALLBACK_TRANSFER_ERROR);
+    i2c->dma_ok = 1;
+}
+#endif
 
 int
 hal_i2c_init(uint8_t i2c_num, void *usercfg)
 {
     struct samd21_i2c_state *i2c;
-    enum status_code status;
-    struct i2c_master_config cfg;
     int rc;
 
     SAMD21_I2C_RESOLVE(i2c_num, i2c);
@@ -119,30 +261,194 @@ hal_i2c_init(uint8_t i2c_num, void *usercfg)
 
     i2c->pconfig = (struct samd21_i2c_config *) usercfg;
 
-    i2c_master_get_config_defaults(&cfg);
-    cfg.pinmux_pad0 = i2c->pconfig->pad0_pinmux;
-    cfg.pinmux_pad1 = i2c->pconfig->pad1_pinmux;
+#if MYNEWT_VAL(I2C_ASYNC)
+    os_mutex_init(&i2c->bus_mutex);
+    os_sem_init(&i2c->done_sem, 0);
+#endif
 
-    status = i2c_master_init(&i2c->module, i2c->hw, &cfg);
-    if (status != STATUS_OK) {
-        rc = (int) status;
+    rc = samd21_i2c_config(i2c);
+    if (rc) {
         goto err;
     }
-
-    i2c_master_enable(&i2c->module);
+#if MYNEWT_VAL(I2C_DMA)
+    samd21_i2c_dma_init(i2c, i2c_num);
+#endif
 
     return (0);
 err:
     return (rc);
 }
 
+/*
+ * Slave which doesn't let go of the bus, or a job which never finishes.
+ * Reset the SERCOM, and set it up again.
+ */
+static void
+samd21_i2c_recover(struct samd21_i2c_state *i2c)
+{
+#if MYNEWT_VAL(I2C_ASYNC)
+    i2c_master_cancel_job(&i2c->module);
+#endif
+    i2c_master_reset(&i2c->module);
+    while (i2c->hw->I2CM.CTRLA.reg & SERCOM_I2CM_CTRLA_SWRST) {
+    }
+    samd21_i2c_config(i2c);
+}
+
+/*
+ * SDK leaves the bus to us on errors without stop.
+ */
+static void
+samd21_i2c_release_bus(struct samd21_i2c_state *i2c)
+{
+    SercomI2cm *hw = &i2c->hw->I2CM;
+
+    if ((hw->STATUS.reg & SERCOM_I2CM_STATUS_BUSSTATE_Msk) ==
+        SERCOM_I2CM_STATUS_BUSSTATE(2)) {
+        i2c_master_send_stop(&i2c->module);
+    }
+}
+
+static enum status_code
+samd21_i2c_xfer_wait(struct samd21_i2c_state *i2c,
+                     struct i2c_master_packet *pkt, int read, uint8_t last_op)
+{
+    if (read) {
+        if (last_op) {
+            return i2c_master_read_packet_wait(&i2c->module, pkt);
+        } else {
+            return i2c_master_read_packet_wait_no_stop(&i2c->module, pkt);
+        }
+    } else {
+        if (last_op) {
+            return i2c_master_write_packet_wait(&i2c->module, pkt);
+        } else {
+            return i2c_master_write_packet_wait_no_stop(&i2c->module, pkt);
+        }
+    }
+}
+
+#if MYNEWT_VAL(I2C_ASYNC)
+/*
+ * Waiting for completion sleeps on a semaphore, which is only possible
+ * from task context with interrupts enabled.
+ */
+static int
+samd21_i2c_can_block(void)
+{
+    return os_started() && __get_IPSR() == 0 && __get_PRIMASK() == 0;
+}
+
+static enum status_code
+samd21_i2c_xfer_async(struct samd21_i2c_state *i2c,
+                      struct i2c_master_packet *pkt, int read,
+                      uint32_t os_ticks, uint8_t last_op)
+{
+    enum status_code status;
+    os_time_t start;
+    os_time_t elapsed;
+
+    start = os_time_get();
+    if (i2c->bus_mutex.mu_owner != os_sched_get_current_task()) {
+        if (os_mutex_pend(&i2c->bus_mutex, os_ticks) != OS_OK) {
+            return STATUS_ERR_TIMEOUT;
+        }
+    }
+
+    /* Time spent waiting for the bus counts against the timeout */
+    elapsed = os_time_get() - start;
+    os_ticks = elapsed < os_ticks ? os_ticks - elapsed : 0;
+
+#if MYNEWT_VAL(I2C_DMA)
+    /* samd21_i2c_read_reg() started before we got the bus */
+    if (i2c->dma_state != SAMD21_I2C_DMA_IDLE) {
+        os_mutex_release(&i2c->bus_mutex);
+        return STATUS_BUSY;
+    }
+#endif
+
+    /* Completion of a job which timed out might have come in late */
+    while (os_sem_pend(&i2c->done_sem, 0) == OS_OK) {
+    }
+
+    if (pkt->data_length == 0) {
+        /*
+         * SDK's interrupt handler never completes zero length jobs
+         * (probe); these are short enough to do polled.
+         */
+        status = samd21_i2c_xfer_wait(i2c, pkt, read, last_op);
+    } else if (os_ticks == 0) {
+        /* Waiting for the bus used up the time; don't start a job */
+        status = STATUS_ERR_TIMEOUT;
+    } else {
+        if (read) {
+            if (last_op) {
+                status = i2c_master_read_packet_job(&i2c->module, pkt);
+            } else {
+                status = i2c_master_read_packet_job_no_stop(&i2c->module,
+                                                            pkt);
+            }
+        } else {
+            if (last_op) {
+                status = i2c_master_write_packet_job(&i2c->module, pkt);
+            } else {
+                status = i2c_master_write_packet_job_no_stop(&i2c->module,
+                                                             pkt);
+            }
+        }
+        if (status == STATUS_OK) {
+            if (os_sem_pend(&i2c->done_sem, os_ticks) == OS_OK) {
+                status = i2c_master_get_job_status(&i2c->module);
+            } else {
+                samd21_i2c_recover(i2c);
+                status = STATUS_ERR_TIMEOUT;
+            }
+        }
+    }
+
+    if (status != STATUS_OK) {
+        samd21_i2c_release_bus(i2c);
+    }
+    if (last_op || status != STATUS_OK) {
+        os_mutex_release(&i2c->bus_mutex);
+    }
+
+    return status;
+}
+#endif
+
+static int
+samd21_i2c_xfer(struct samd21_i2c_state *i2c, struct i2c_master_packet *pkt,
+                int read, uint32_t os_ticks, uint8_t last_op)
+{
+    enum status_code status;
+
+#if MYNEWT_VAL(I2C_DMA)
+    if (i2c->dma_state != SAMD21_I2C_DMA_IDLE) {
+        return (int) STATUS_BUSY;
+    }
+#endif
+
+#if MYNEWT_VAL(I2C_ASYNC)
+    if (samd21_i2c_can_block()) {
+        status = samd21_i2c_xfer_async(i2c, pkt, read, os_ticks, last_op);
+    } else {
+        status = samd21_i2c_xfer_wait(i2c, pkt, read, last_op);
+    }
+#else
+    status = samd21_i2c_xfer_wait(i2c, pkt, read, last_op);
+#endif
+    samd21_i2c_stats_update(i2c, status, pkt->data_length);
+
+    return (int) status;
+}
+
 int
 hal_i2c_master_write(uint8_t i2c_num, struct hal_i2c_master_data *ppkt,
   uint32_t os_ticks, uint8_t last_op)
 {
     struct samd21_i2c_state *i2c;
     struct i2c_master_packet pkt;
-    enum status_code status;
     int rc;
 
     SAMD21_I2C_RESOLVE(i2c_num, i2c);
@@ -152,13 +458,8 @@ hal_i2c_master_write(uint8_t i2c_num, struct hal_i2c_master_data *ppkt,
     pkt.data_length = ppkt->len;
     pkt.data = ppkt->buffer;
 
-    if (last_op) {
-        status = i2c_master_write_packet_wait(&i2c->module, &pkt);
-    } else {
-        status = i2c_master_write_packet_wait_no_stop(&i2c->module, &pkt);
-    }
-    if (status != STATUS_OK) {
-        rc = (int) status;
+    rc = samd21_i2c_xfer(i2c, &pkt, 0, os_ticks, last_op);
+    if (rc) {
         goto err;
     }
 
@@ -173,7 +474,6 @@ hal_i2c_master_read(uint8_t i2c_num, struct hal_i2c_master_data *ppkt,
 {
     struct samd21_i2c_state *i2c;
     struct i2c_master_packet pkt;
-    enum status_code status;
     int rc;
 
     SAMD21_I2C_RESOLVE(i2c_num, i2c);
@@ -183,13 +483,8 @@ hal_i2c_master_read(uint8_t i2c_num, struct hal_i2c_master_data *ppkt,
     pkt.data_length = ppkt->len;
     pkt.data = ppkt->buffer;
 
-    if (last_op ) {
-        status = i2c_master_read_packet_wait(&i2c->module, &pkt);
-    } else {
-        status = i2c_master_read_packet_wait_no_stop(&i2c->module, &pkt);
-    }
-    if (status != STATUS_OK) {
-        rc = (int) status;
+    rc = samd21_i2c_xfer(i2c, &pkt, 1, os_ticks, last_op);
+    if (rc) {
         goto err;
     }
     return (0);
@@ -202,7 +497,6 @@ hal_i2c_master_probe(uint8_t i2c_num, uint8_t address, uint32_t os_ticks)
 {
     struct samd21_i2c_state *i2c;
     struct i2c_master_packet pkt;
-    enum status_code status;
     int rc;
     uint8_t buf;
 
@@ -213,13 +507,219 @@ hal_i2c_master_probe(uint8_t i2c_num, uint8_t address, uint32_t os_ticks)
     pkt.data_length = 0;
     pkt.data = &buf;
 
-    status = i2c_master_read_packet_wait(&i2c->module, &pkt);
+    rc = samd21_i2c_xfer(i2c, &pkt, 1, os_ticks, 1);
+    if (rc) {
+        goto err;
+    }
+
+    return (0);
+err:
+    return (rc);
+}
+
+int
+samd21_i2c_stats_get(uint8_t i2c_num, struct samd21_i2c_stats *stats)
+{
+    struct samd21_i2c_state *i2c;
+    int rc;
+
+    SAMD21_I2C_RESOLVE(i2c_num, i2c);
+
+    *stats = i2c->stats;
+    return (0);
+err:
+    return (rc);
+}
+
+#if MYNEWT_VAL(I2C_DMA)
+static void
+samd21_i2c_dma_finish(struct samd21_i2c_state *i2c, enum status_code status)
+{
+    SercomI2cm *hw = &i2c->hw->I2CM;
+
+    /* DMA and SERCOM interrupts, and abort, can race to get here */
+    cpu_irq_enter_critical();
+    if (i2c->dma_state != SAMD21_I2C_DMA_RUN) {
+        cpu_irq_leave_critical();
+        return;
+    }
+    i2c->dma_state = SAMD21_I2C_DMA_FINISH;
+    cpu_irq_leave_critical();
+
+    hw->INTENCLR.reg = SERCOM_I2CM_INTENCLR_SB | SERCOM_I2CM_INTENCLR_MB |
+                       SERCOM_I2CM_INTENCLR_ERROR;
+    if (status != STATUS_OK) {
+        dma_abort_job(&i2c->dma);
+        samd21_i2c_release_bus(i2c);
+    }
+#if MYNEWT_VAL(I2C_ASYNC)
+    _sercom_set_handler(_sercom_get_sercom_inst_index(i2c->hw),
+                        _i2c_master_interrupt_handler);
+#endif
+    samd21_i2c_stats_update(i2c, status, i2c->dma_bytes);
+
+    i2c->dma_state = SAMD21_I2C_DMA_IDLE;
+    i2c->dma_cb(i2c->dma_cb_arg, (int) status);
+}
+
+static void
+samd21_i2c_dma_done(struct dma_resource *resource)
+{
+    struct samd21_i2c_state *i2c;
+
+    i2c = (struct samd21_i2c_state *)
+          ((uint8_t *)resource - offsetof(struct samd21_i2c_state, dma));
+
+    if (resource->job_status != STATUS_OK) {
+        samd21_i2c_dma_finish(i2c, STATUS_ERR_DENIED);
+        return;
+    }
+    /* Last byte is left for the SERCOM interrupt */
+    i2c->hw->I2CM.INTENSET.reg = SERCOM_I2CM_INTENSET_SB;
+}
+
+static void
+samd21_i2c_dma_irq(uint8_t instance)
+{
+    struct samd21_i2c_state *i2c;
+    enum status_code status;
+    SercomI2cm *hw;
+    uint32_t flags;
+
+    i2c = samd21_hal_i2cs[instance];
+    hw = &i2c->hw->I2CM;
+    flags = hw->INTFLAG.reg & hw->INTENSET.reg;
+
+    if (flags & (SERCOM_I2CM_INTFLAG_MB | SERCOM_I2CM_INTFLAG_ERROR)) {
+        /*
+         * MB during a read means the address was NACKed, arbitration
+         * was lost or there was a bus error.
+         */
+        if (hw->STATUS.reg & SERCOM_I2CM_STATUS_ARBLOST) {
+            status = STATUS_ERR_PACKET_COLLISION;
+        } else if (hw->STATUS.reg & SERCOM_I2CM_STATUS_RXNACK) {
+            status = STATUS_ERR_BAD_ADDRESS;
+        } else {
+            status = STATUS_ERR_DENIED;
+        }
+        hw->INTFLAG.reg = SERCOM_I2CM_INTFLAG_MB | SERCOM_I2CM_INTFLAG_ERROR;
+        samd21_i2c_dma_finish(i2c, status);
+    } else if (flags & SERCOM_I2CM_INTFLAG_SB) {
+        hw->CTRLB.reg |= SERCOM_I2CM_CTRLB_ACKACT;
+        while (hw->SYNCBUSY.reg) {
+        }
+        hw->CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(3);
+        while (hw->SYNCBUSY.reg) {
+        }
+        i2c->dma_buf[i2c->dma_len - 1] = hw->DATA.reg;
+        samd21_i2c_dma_finish(i2c, STATUS_OK);
+    }
+}
+
+int
+samd21_i2c_read_reg(uint8_t i2c_num, uint8_t address, const void *reg,
+                    uint8_t reg_len, void *buf, uint16_t len,
+                    samd21_i2c_done_t done, void *arg)
+{
+    struct samd21_i2c_state *i2c;
+    struct dma_descriptor_config cfg;
+    struct i2c_master_packet pkt;
+    enum status_code status;
+    SercomI2cm *hw;
+    int rc;
+
+    if (i2c_num >= HAL_SAMD21_I2C_MAX || !samd21_hal_i2cs[i2c_num]) {
+        rc = STATUS_ERR_INVALID_ARG;
+        goto err;
+    }
+    i2c = samd21_hal_i2cs[i2c_num];
+
+    if (!i2c->dma_ok || len == 0 || done == NULL) {
+        rc = STATUS_ERR_INVALID_ARG;
+        goto err;
+    }
+    hw = &i2c->hw->I2CM;
+
+    cpu_irq_enter_critical();
+    if (i2c->dma_state != SAMD21_I2C_DMA_IDLE
+#if MYNEWT_VAL(I2C_ASYNC)
+        || i2c->bus_mutex.mu_owner != NULL
+#endif
+        ) {
+        cpu_irq_leave_critical();
+        rc = STATUS_BUSY;
+        goto err;
+    }
+    i2c->dma_state = SAMD21_I2C_DMA_RUN;
+    cpu_irq_leave_critical();
+
+    i2c->dma_buf = buf;
+    i2c->dma_len = len;
+    i2c->dma_bytes = reg_len + len;
+    i2c->dma_cb = done;
+    i2c->dma_cb_arg = arg;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.address = address;
+    pkt.data_length = reg_len;
+    pkt.data = (uint8_t *)reg;
+    status = i2c_master_write_packet_wait_no_stop(&i2c->module, &pkt);
     if (status != STATUS_OK) {
+        samd21_i2c_release_bus(i2c);
+        samd21_i2c_stats_update(i2c, status, 0);
+        i2c->dma_state = SAMD21_I2C_DMA_IDLE;
         rc = (int) status;
         goto err;
     }
 
+    if (len > 1) {
+        /* DMAC wants the address one past the last beat when incrementing */
+        dma_descriptor_get_config_defaults(&cfg);
+        cfg.beat_size = DMA_BEAT_SIZE_BYTE;
+        cfg.block_transfer_count = len - 1;
+        cfg.src_increment_enable = false;
+        cfg.source_address = (uint32_t)&hw->DATA.reg;
+        cfg.destination_address = (uint32_t)buf + len - 1;
+        dma_descriptor_create(&i2c->dma_desc, &cfg);
+        dma_update_descriptor(&i2c->dma, &i2c->dma_desc);
+        if (dma_start_transfer_job(&i2c->dma) != STATUS_OK) {
+            samd21_i2c_release_bus(i2c);
+            i2c->dma_state = SAMD21_I2C_DMA_IDLE;
+            rc = STATUS_ERR_IO;
+            goto err;
+        }
+    }
+
+    _sercom_set_handler(i2c_num, samd21_i2c_dma_irq);
+    system_interrupt_enable(_sercom_get_interrupt_vector(i2c->hw));
+
+    /* Repeated start, with read */
+    hw->CTRLB.reg &= ~SERCOM_I2CM_CTRLB_ACKACT;
+    hw->INTFLAG.reg = SERCOM_I2CM_INTFLAG_MB | SERCOM_I2CM_INTFLAG_ERROR;
+    hw->INTENSET.reg = SERCOM_I2CM_INTENSET_MB | SERCOM_I2CM_INTENSET_ERROR |
+                       (len == 1 ? SERCOM_I2CM_INTENSET_SB : 0);
+    while (hw->SYNCBUSY.reg) {
+    }
+    hw->ADDR.reg = (address << 1) | I2C_TRANSFER_READ;
+
     return (0);
 err:
     return (rc);
 }
+
+void
+samd21_i2c_abort(uint8_t i2c_num)
+{
+    struct samd21_i2c_state *i2c;
+
+    if (i2c_num >= HAL_SAMD21_I2C_MAX || !samd21_hal_i2cs[i2c_num]) {
+        return;
+    }
+    i2c = samd21_hal_i2cs[i2c_num];
+
+    if (i2c->dma_state == SAMD21_I2C_DMA_RUN) {
+        samd21_i2c_recover(i2c);
+        samd21_i2c_dma_finish(i2c, STATUS_ABORTED);
+    }
+}
+#endif
@@ -4,7 +4,7 @@
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
  * You may obtain a copy of the License at
- * 
+ *
  *   http://www.apache.org/licenses/LICENSE-2.0
  *
  * Unless required by applicable law or agreed to in writing, software
@@ -15,12 +15,156 @@
  */
 
 #include <assert.h>
+#include "syscfg/syscfg.h"
 #include <os/os.h>
 #include <hal/hal_os_tick.h>
+#if MYNEWT_VAL(TICKLESS_IDLE)
+#include "mcu/cmsis_nvic.h"
+#include "sam0/drivers/system/clock/clock.h"
+#include "sam0/drivers/system/clock/gclk.h"
+#endif
+
+#if MYNEWT_VAL(TICKLESS_IDLE)
+/*
+ * SysTick keeps OS time while running. When idling for more than one tick,
+ * SysTick is stopped and the RTC, clocked from the 32kHz ULP oscillator,
+ * wakes us up at the next timer expiry. Time spent sleeping is measured
+ * with the RTC counter and added to OS time after wakeup.
+ */
+#define SAMD21_RTC_FREQ             32768
+
+/*
+ * Don't sleep longer than what fits in RTC counter with margin.
+ */
+#define SAMD21_TICKLESS_MAX_TICKS                                       \
+    ((os_time_t)(((uint64_t)0x7fffffff * OS_TICKS_PER_SEC) / SAMD21_RTC_FREQ))
+
+static struct {
+    uint32_t residual;          /* leftover (RTC counts * OS_TICKS_PER_SEC) */
+} samd21_tickless;
+
+static inline void
+samd21_rtc_sync(void)
+{
+    while (RTC->MODE0.STATUS.bit.SYNCBUSY) {
+    }
+}
+
+static inline uint32_t
+samd21_rtc_count(void)
+{
+    RTC->MODE0.READREQ.reg = RTC_READREQ_RREQ;
+    samd21_rtc_sync();
+    return RTC->MODE0.COUNT.reg;
+}
 
 /*
- * XXX implement tickless mode.
+ * Only used to wake up from WFI. Time is accounted in os_tick_idle().
  */
+static void
+samd21_rtc_irq_handler(void)
+{
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+}
+
+static void
+samd21_tickless_init(void)
+{
+    struct system_gclk_gen_config gcfg;
+    struct system_gclk_chan_config ccfg;
+
+    system_apb_clock_set_mask(SYSTEM_CLOCK_APB_APBA, PM_APBAMASK_RTC);
+
+    system_gclk_gen_get_config_defaults(&gcfg);
+    gcfg.source_clock = SYSTEM_CLOCK_SOURCE_ULP32K;
+    gcfg.division_factor = 1;
+    gcfg.run_in_standby = true;
+    system_gclk_gen_set_config(MYNEWT_VAL(TICKLESS_IDLE_CLKGEN), &gcfg);
+    system_gclk_gen_enable(MYNEWT_VAL(TICKLESS_IDLE_CLKGEN));
+
+    system_gclk_chan_get_config_defaults(&ccfg);
+    ccfg.source_generator = MYNEWT_VAL(TICKLESS_IDLE_CLKGEN);
+    system_gclk_chan_set_config(RTC_GCLK_ID, &ccfg);
+    system_gclk_chan_enable(RTC_GCLK_ID);
+
+    RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_SWRST;
+    while (RTC->MODE0.CTRL.reg & RTC_MODE0_CTRL_SWRST) {
+    }
+
+    /* 32 bit free running counter, 1 count per 32kHz cycle */
+    RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32 |
+      RTC_MODE0_CTRL_PRESCALER_DIV1;
+    samd21_rtc_sync();
+    RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_MASK;
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_MASK;
+    RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_ENABLE;
+    samd21_rtc_sync();
+
+    NVIC_SetVector(RTC_IRQn, (uint32_t)samd21_rtc_irq_handler);
+    NVIC_SetPriority(RTC_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
+    NVIC_EnableIRQ(RTC_IRQn);
+}
+
+void
+os_tick_idle(os_time_t ticks)
+{
+    uint32_t start;
+    uint32_t cnt;
+    uint64_t acc;
+    os_time_t adv;
+
+    OS_ASSERT_CRITICAL();
+
+    if (ticks < 2) {
+        /*
+         * Next tick is soon enough; not worth stopping SysTick.
+         */
+        __DSB();
+        __WFI();
+        return;
+    }
+    if (ticks > SAMD21_TICKLESS_MAX_TICKS) {
+        ticks = SAMD21_TICKLESS_MAX_TICKS;
+    }
+
+    /*
+     * Stop SysTick. Counter value is retained, so the tick in progress
+     * continues where it left off when SysTick is started again.
+     */
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+
+    start = samd21_rtc_count();
+    cnt = ((uint64_t)ticks * SAMD21_RTC_FREQ - samd21_tickless.residual +
+      OS_TICKS_PER_SEC - 1) / OS_TICKS_PER_SEC;
+    RTC->MODE0.COMP[0].reg = start + cnt;
+    samd21_rtc_sync();
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+    RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP0;
+
+    __DSB();
+    __WFI();
+
+    RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_CMP0;
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+    NVIC_ClearPendingIRQ(RTC_IRQn);
+
+    /*
+     * We might have been woken up early by some other interrupt. Advance
+     * OS time by the amount we actually slept, carrying over the part
+     * which was less than a full tick.
+     */
+    cnt = samd21_rtc_count() - start;
+    acc = (uint64_t)cnt * OS_TICKS_PER_SEC + samd21_tickless.residual;
+    adv = acc / SAMD21_RTC_FREQ;
+    samd21_tickless.residual = acc % SAMD21_RTC_FREQ;
+
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+    if (adv > 0) {
+        os_time_advance(adv);
+    }
+}
+#else
 void
 os_tick_idle(os_time_t ticks)
 {
@@ -28,6 +172,7 @@ os_tick_idle(os_time_t ticks)
     __DSB();
     __WFI();
 }
+#endif
 
 void
 os_tick_init(uint32_t os_ticks_per_sec, int prio)
@@ -43,4 +188,8 @@ os_tick_init(uint32_t os_ticks_per_sec, int prio)
 
     /* Set the system tick priority */
     NVIC_SetPriority(SysTick_IRQn, prio);
+
+#if MYNEWT_VAL(TICKLESS_IDLE)
+    samd21_tickless_init();
+#endif
 }
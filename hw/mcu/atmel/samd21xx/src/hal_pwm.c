@@ -0,0 +1,571 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "syscfg/syscfg.h"
+#include "compiler.h"
+#include "mcu/hal_pwm.h"
+#include "mcu/samd21.h"
+#include "mcu/cmsis_nvic.h"
+#include "sam0/drivers/tc/tc.h"
+#include "sam0/drivers/tcc/tcc.h"
+#include "sam0/drivers/dma/dma.h"
+#include "sam0/drivers/system/pinmux/pinmux.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#include "samd21_priv.h"
+
+#if MYNEWT_VAL(PWM)
+
+#define SAMD21_PWM_FLAG_INIT        (0x1)
+#define SAMD21_PWM_FLAG_TCC         (0x2)
+#define SAMD21_PWM_FLAG_DMA         (0x4)   /* DMA channel allocated */
+#define SAMD21_PWM_FLAG_DMA_RUN     (0x8)
+#define SAMD21_PWM_FLAG_DMA_LOOP    (0x10)
+
+/* TC in match PWM mode outputs on WO[1] only; CC0 is the period */
+#define SAMD21_PWM_TC_CHAN          1
+
+struct samd21_pwm {
+    union {
+        struct tc_module            tc;
+        struct tcc_module           tcc;
+    };
+    uint8_t                         flags;
+    uint8_t                         nchan;
+    uint8_t                         dma_trig;
+    uint32_t                        top;
+    uint32_t                        max;    /* largest count counter holds */
+
+    /*
+     * TC doesn't have buffered compare registers. New duty cycle is kept
+     * here, and written to CC1 from overflow interrupt.
+     */
+    uint16_t                        tc_duty;
+
+    struct dma_resource             dma;
+    COMPILER_ALIGNED(16) DmacDescriptor dma_desc;
+    samd21_pwm_dma_cb               dma_cb;
+    void                           *dma_arg;
+};
+
+static struct samd21_pwm samd21_pwms[SAMD21_PWM_MAX];
+
+/* Indexed by enum samd_tc_tcc_clock_prescaler */
+static const uint16_t samd21_pwm_presc_div[] = {
+    1, 2, 4, 8, 16, 64, 256, 1024
+};
+
+static int
+samd21_pwm_period(enum samd_tc_tcc_clock_prescaler presc, int freq,
+                  uint32_t max, uint32_t *top)
+{
+    uint32_t cnt;
+
+    if (presc < SAMD_TC_CLOCK_PRESCALER_DIV1 ||
+        presc > SAMD_TC_CLOCK_PRESCALER_DIV1024 || freq <= 0) {
+        return EINVAL;
+    }
+    cnt = SystemCoreClock / samd21_pwm_presc_div[presc] / freq;
+    if (cnt < 2 || cnt - 1 > max) {
+        return EINVAL;
+    }
+    *top = cnt - 1;
+    return 0;
+}
+
+static struct samd21_pwm *
+samd21_pwm_get(int pwm)
+{
+    struct samd21_pwm *p;
+
+    if (pwm < 0 || pwm >= SAMD21_PWM_MAX) {
+        return NULL;
+    }
+    p = &samd21_pwms[pwm];
+    if (!(p->flags & SAMD21_PWM_FLAG_INIT)) {
+        return NULL;
+    }
+    return p;
+}
+
+static void
+samd21_pwm_tc_irq(struct samd21_pwm *p)
+{
+    TcCount16 *hw = &p->tc.hw->COUNT16;
+
+    hw->INTENCLR.reg = TC_INTENCLR_OVF;
+    hw->INTFLAG.reg = TC_INTFLAG_OVF;
+    hw->CC[SAMD21_PWM_TC_CHAN].reg = p->tc_duty;
+}
+
+static void
+samd21_pwm_tc3_irq(void)
+{
+    samd21_pwm_tc_irq(&samd21_pwms[SAMD21_PWM_TC(SAMD_TC_DEV_3)]);
+}
+
+static void
+samd21_pwm_tc4_irq(void)
+{
+    samd21_pwm_tc_irq(&samd21_pwms[SAMD21_PWM_TC(SAMD_TC_DEV_4)]);
+}
+
+static void
+samd21_pwm_tc5_irq(void)
+{
+    samd21_pwm_tc_irq(&samd21_pwms[SAMD21_PWM_TC(SAMD_TC_DEV_5)]);
+}
+
+int
+samd21_pwm_tc_init(enum samd_tc_device_id id,
+                   const struct samd21_pwm_tc_config *pconfig)
+{
+    struct samd21_pwm *p;
+    struct tc_config cfg;
+    Tc *hw;
+    void (*irq)(void);
+    IRQn_Type irqn;
+    int rc;
+
+    switch (id) {
+    case SAMD_TC_DEV_3:
+        hw = TC3;
+        irq = samd21_pwm_tc3_irq;
+        irqn = TC3_IRQn;
+        break;
+    case SAMD_TC_DEV_4:
+        hw = TC4;
+        irq = samd21_pwm_tc4_irq;
+        irqn = TC4_IRQn;
+        break;
+    case SAMD_TC_DEV_5:
+        hw = TC5;
+        irq = samd21_pwm_tc5_irq;
+        irqn = TC5_IRQn;
+        break;
+    default:
+        return EINVAL;
+    }
+    p = &samd21_pwms[SAMD21_PWM_TC(id)];
+    if (p->flags & SAMD21_PWM_FLAG_INIT) {
+        return EBUSY;
+    }
+    p->max = UINT16_MAX;
+    rc = samd21_pwm_period(pconfig->prescalar, pconfig->clock_freq,
+                           p->max, &p->top);
+    if (rc) {
+        return rc;
+    }
+
+    tc_get_config_defaults(&cfg);
+    cfg.counter_size = TC_COUNTER_SIZE_16BIT;
+    cfg.clock_prescaler =
+      (enum tc_clock_prescaler)TC_CTRLA_PRESCALER(pconfig->prescalar);
+    cfg.wave_generation = TC_WAVE_GENERATION_MATCH_PWM;
+    cfg.counter_16_bit.compare_capture_channel[0] = p->top;
+    cfg.counter_16_bit.compare_capture_channel[SAMD21_PWM_TC_CHAN] = 0;
+    if (tc_init(&p->tc, hw, &cfg) != STATUS_OK) {
+        return EIO;
+    }
+
+    p->nchan = 1;
+    p->dma_trig = TC3_DMAC_ID_OVF + (id - SAMD_TC_DEV_3) * 3;
+    p->flags = SAMD21_PWM_FLAG_INIT;
+
+    NVIC_SetVector(irqn, (uint32_t)irq);
+    NVIC_EnableIRQ(irqn);
+    return 0;
+}
+
+int
+samd21_pwm_tcc_init(enum samd_tcc_device_id id,
+                    const struct samd21_pwm_tcc_config *pconfig)
+{
+    struct samd21_pwm *p;
+    struct tcc_config cfg;
+    Tcc *hw;
+    uint32_t max;
+    int rc;
+
+    switch (id) {
+    case SAMD_TCC_DEV_0:
+        hw = TCC0;
+        max = (1UL << TCC0_SIZE) - 1;
+        break;
+    case SAMD_TCC_DEV_1:
+        hw = TCC1;
+        max = (1UL << TCC1_SIZE) - 1;
+        break;
+    case SAMD_TCC_DEV_2:
+        hw = TCC2;
+        max = (1UL << TCC2_SIZE) - 1;
+        break;
+    default:
+        return EINVAL;
+    }
+    p = &samd21_pwms[SAMD21_PWM_TCC(id)];
+    if (p->flags & SAMD21_PWM_FLAG_INIT) {
+        return EBUSY;
+    }
+    p->max = max;
+    rc = samd21_pwm_period(pconfig->prescalar, pconfig->clock_freq, max,
+                           &p->top);
+    if (rc) {
+        return rc;
+    }
+
+    /*
+     * Double buffering is on by default: compare values are written to
+     * CCBx, and copied to CCx on the next UPDATE condition.
+     */
+    tcc_get_config_defaults(&cfg, hw);
+    cfg.counter.period = p->top;
+    cfg.counter.clock_prescaler =
+      (enum tcc_clock_prescaler)TCC_CTRLA_PRESCALER(pconfig->prescalar);
+    cfg.compare.wave_generation = TCC_WAVE_GENERATION_NORMAL_PWM;
+    cfg.double_buffering_enabled = true;
+    if (tcc_init(&p->tcc, hw, &cfg) != STATUS_OK) {
+        return EIO;
+    }
+
+    switch (id) {
+    case SAMD_TCC_DEV_0:
+        p->nchan = TCC0_CC_NUM;
+        p->dma_trig = TCC0_DMAC_ID_OVF;
+        break;
+    case SAMD_TCC_DEV_1:
+        p->nchan = TCC1_CC_NUM;
+        p->dma_trig = TCC1_DMAC_ID_OVF;
+        break;
+    default:
+        p->nchan = TCC2_CC_NUM;
+        p->dma_trig = TCC2_DMAC_ID_OVF;
+        break;
+    }
+    p->flags = SAMD21_PWM_FLAG_INIT | SAMD21_PWM_FLAG_TCC;
+    return 0;
+}
+
+int
+samd21_pwm_pin_config(int pwm, uint32_t pinmux)
+{
+    struct system_pinmux_config cfg;
+
+    if (!samd21_pwm_get(pwm)) {
+        return EINVAL;
+    }
+    system_pinmux_get_config_defaults(&cfg);
+    cfg.mux_position = pinmux & 0xffff;
+    cfg.direction = SYSTEM_PINMUX_PIN_DIR_OUTPUT;
+    system_pinmux_pin_set_config(pinmux >> 16, &cfg);
+    return 0;
+}
+
+uint32_t
+samd21_pwm_get_top(int pwm)
+{
+    struct samd21_pwm *p;
+
+    p = samd21_pwm_get(pwm);
+    if (!p) {
+        return 0;
+    }
+    return p->top;
+}
+
+int
+samd21_pwm_enable(int pwm)
+{
+    struct samd21_pwm *p;
+
+    p = samd21_pwm_get(pwm);
+    if (!p) {
+        return EINVAL;
+    }
+    if (p->flags & SAMD21_PWM_FLAG_TCC) {
+        tcc_enable(&p->tcc);
+    } else {
+        tc_enable(&p->tc);
+    }
+    return 0;
+}
+
+int
+samd21_pwm_disable(int pwm)
+{
+    struct samd21_pwm *p;
+
+    p = samd21_pwm_get(pwm);
+    if (!p) {
+        return EINVAL;
+    }
+    if (p->flags & SAMD21_PWM_FLAG_DMA_RUN) {
+        samd21_pwm_dma_stop(pwm);
+    }
+    if (p->flags & SAMD21_PWM_FLAG_TCC) {
+        tcc_disable(&p->tcc);
+    } else {
+        p->tc.hw->COUNT16.INTENCLR.reg = TC_INTENCLR_OVF;
+        tc_disable(&p->tc);
+    }
+    return 0;
+}
+
+/*
+ * top + 1 keeps output on for the whole period, but with top at counter
+ * max it doesn't fit in the compare register; full scale then ends up
+ * one count short.
+ */
+static uint32_t
+samd21_pwm_duty_clamp(struct samd21_pwm *p, uint32_t duty)
+{
+    uint32_t limit;
+
+    limit = p->top < p->max ? p->top + 1 : p->max;
+    return duty > limit ? limit : duty;
+}
+
+static int
+samd21_pwm_chan_ok(struct samd21_pwm *p, int channel)
+{
+    if (p->flags & SAMD21_PWM_FLAG_TCC) {
+        return channel >= 0 && channel < p->nchan;
+    } else {
+        return channel == SAMD21_PWM_TC_CHAN;
+    }
+}
+
+int
+samd21_pwm_set_duty(int pwm, int channel, uint32_t duty)
+{
+    struct samd21_pwm *p;
+    TcCount16 *hw;
+
+    p = samd21_pwm_get(pwm);
+    if (!p || !samd21_pwm_chan_ok(p, channel)) {
+        return EINVAL;
+    }
+    if (p->flags & SAMD21_PWM_FLAG_DMA_RUN) {
+        return EBUSY;
+    }
+    duty = samd21_pwm_duty_clamp(p, duty);
+    if (p->flags & SAMD21_PWM_FLAG_TCC) {
+        tcc_set_compare_value(&p->tcc, (enum tcc_match_capture_channel)channel,
+                              duty);
+    } else {
+        /*
+         * Apply at next overflow, so that the period in progress is not
+         * cut short.
+         */
+        hw = &p->tc.hw->COUNT16;
+        cpu_irq_enter_critical();
+        p->tc_duty = duty;
+        hw->INTFLAG.reg = TC_INTFLAG_OVF;
+        hw->INTENSET.reg = TC_INTENSET_OVF;
+        cpu_irq_leave_critical();
+    }
+    return 0;
+}
+
+int
+samd21_pwm_set_duties(int pwm, uint8_t chan_mask, const uint32_t *duty)
+{
+    struct samd21_pwm *p;
+    uint32_t val;
+    int i;
+
+    p = samd21_pwm_get(pwm);
+    if (!p) {
+        return EINVAL;
+    }
+    if (!(p->flags & SAMD21_PWM_FLAG_TCC)) {
+        if (chan_mask & ~(1 << SAMD21_PWM_TC_CHAN)) {
+            return EINVAL;
+        }
+        if (!chan_mask) {
+            return 0;
+        }
+        return samd21_pwm_set_duty(pwm, SAMD21_PWM_TC_CHAN,
+                                   duty[SAMD21_PWM_TC_CHAN]);
+    }
+    if (chan_mask >> p->nchan) {
+        return EINVAL;
+    }
+    if (p->flags & SAMD21_PWM_FLAG_DMA_RUN) {
+        return EBUSY;
+    }
+
+    /*
+     * With LUPD set, buffered values are held back. Once all are written,
+     * clearing it lets them go to CCx together on the next UPDATE.
+     */
+    tcc_lock_double_buffer_update(&p->tcc);
+    for (i = 0; i < p->nchan; i++) {
+        if (chan_mask & (1 << i)) {
+            val = samd21_pwm_duty_clamp(p, duty[i]);
+            tcc_set_compare_value(&p->tcc, (enum tcc_match_capture_channel)i,
+                                  val);
+        }
+    }
+    tcc_unlock_double_buffer_update(&p->tcc);
+    return 0;
+}
+
+static void
+samd21_pwm_dma_done(struct dma_resource *resource)
+{
+    struct samd21_pwm *p;
+
+    for (p = samd21_pwms; p < &samd21_pwms[SAMD21_PWM_MAX]; p++) {
+        if (&p->dma == resource) {
+            break;
+        }
+    }
+    if (p == &samd21_pwms[SAMD21_PWM_MAX]) {
+        return;
+    }
+    if (resource->job_status != STATUS_OK) {
+        return;
+    }
+    if (!(p->flags & SAMD21_PWM_FLAG_DMA_LOOP)) {
+        p->flags &= ~SAMD21_PWM_FLAG_DMA_RUN;
+    }
+    if (p->dma_cb) {
+        p->dma_cb(p->dma_arg);
+    }
+}
+
+/*
+ * Flags are also updated from samd21_pwm_dma_done().
+ */
+static void
+samd21_pwm_dma_clear(struct samd21_pwm *p)
+{
+    cpu_irq_enter_critical();
+    p->flags &= ~(SAMD21_PWM_FLAG_DMA_RUN | SAMD21_PWM_FLAG_DMA_LOOP);
+    cpu_irq_leave_critical();
+}
+
+int
+samd21_pwm_dma_start(int pwm, int channel, const void *table, int cnt,
+                     int repeat, samd21_pwm_dma_cb cb, void *arg)
+{
+    struct samd21_pwm *p;
+    struct dma_resource_config dcfg;
+    struct dma_descriptor_config cfg;
+    int beat;
+
+    p = samd21_pwm_get(pwm);
+    if (!p || !samd21_pwm_chan_ok(p, channel) || !table || cnt <= 0 ||
+        cnt > UINT16_MAX) {
+        return EINVAL;
+    }
+
+    /*
+     * Flags are set before the job starts; a short one-shot stream can
+     * be over, and DMA_RUN cleared from interrupt, before start returns.
+     */
+    cpu_irq_enter_critical();
+    if (p->flags & SAMD21_PWM_FLAG_DMA_RUN) {
+        cpu_irq_leave_critical();
+        return EBUSY;
+    }
+    p->flags |= SAMD21_PWM_FLAG_DMA_RUN;
+    if (repeat) {
+        p->flags |= SAMD21_PWM_FLAG_DMA_LOOP;
+    } else {
+        p->flags &= ~SAMD21_PWM_FLAG_DMA_LOOP;
+    }
+    cpu_irq_leave_critical();
+
+    if (!(p->flags & SAMD21_PWM_FLAG_DMA)) {
+        samd21_dma_init();
+
+        dma_get_config_defaults(&dcfg);
+        dcfg.peripheral_trigger = p->dma_trig;
+        dcfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+        dcfg.priority = DMA_PRIORITY_LEVEL_1;
+        if (dma_allocate(&p->dma, &dcfg) != STATUS_OK) {
+            samd21_pwm_dma_clear(p);
+            return ENOMEM;
+        }
+        dma_register_callback(&p->dma, samd21_pwm_dma_done,
+                              DMA_CALLBACK_TRANSFER_DONE);
+        dma_enable_callback(&p->dma, DMA_CALLBACK_TRANSFER_DONE);
+        cpu_irq_enter_critical();
+        p->flags |= SAMD21_PWM_FLAG_DMA;
+        cpu_irq_leave_critical();
+    }
+
+    p->dma_cb = cb;
+    p->dma_arg = arg;
+
+    /*
+     * One beat per overflow. For TCC the value goes to CCBx, and reaches
+     * CCx on the following UPDATE; on TC it is written to CC1 right at
+     * overflow, which is the start of the new period.
+     */
+    dma_descriptor_get_config_defaults(&cfg);
+    cfg.dst_increment_enable = false;
+    cfg.block_transfer_count = cnt;
+    if (p->flags & SAMD21_PWM_FLAG_TCC) {
+        cfg.beat_size = DMA_BEAT_SIZE_WORD;
+        cfg.destination_address = (uint32_t)&p->tcc.hw->CCB[channel].reg;
+        beat = sizeof(uint32_t);
+    } else {
+        p->tc.hw->COUNT16.INTENCLR.reg = TC_INTENCLR_OVF;
+        cfg.beat_size = DMA_BEAT_SIZE_HWORD;
+        cfg.destination_address = (uint32_t)&p->tc.hw->COUNT16.CC[channel].reg;
+        beat = sizeof(uint16_t);
+    }
+    /* source is the end address when incrementing */
+    cfg.source_address = (uint32_t)table + cnt * beat;
+    /* Interrupt also without cb, to see the end of one-shot streams */
+    cfg.block_action = DMA_BLOCK_ACTION_INT;
+    if (repeat) {
+        cfg.next_descriptor_address = (uint32_t)&p->dma_desc;
+    }
+    dma_descriptor_create(&p->dma_desc, &cfg);
+    dma_update_descriptor(&p->dma, &p->dma_desc);
+
+    if (dma_start_transfer_job(&p->dma) != STATUS_OK) {
+        samd21_pwm_dma_clear(p);
+        return EIO;
+    }
+    return 0;
+}
+
+int
+samd21_pwm_dma_stop(int pwm)
+{
+    struct samd21_pwm *p;
+
+    p = samd21_pwm_get(pwm);
+    if (!p || !(p->flags & SAMD21_PWM_FLAG_DMA_RUN)) {
+        return EINVAL;
+    }
+    dma_abort_job(&p->dma);
+    samd21_pwm_dma_clear(p);
+    return 0;
+}
+
+#endif /* MYNEWT_VAL(PWM) */
@@ -16,8 +16,10 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
 
 #include "syscfg/syscfg.h"
+#include "os/os.h"
 #include "hal/hal_spi.h"
 #include "compiler.h"
 #include "port.h"
@@ -26,11 +28,15 @@
 #include "sercom.h"
 #include "spi.h"
 #include "spi_interrupt.h"
+#if MYNEWT_VAL(SPI_DMA)
+#include "sam0/drivers/dma/dma.h"
+#endif
 #include "samd21_priv.h"
 
 #define SAMD21_SPI_FLAG_MASTER      (0x1)
 #define SAMD21_SPI_FLAG_ENABLED     (0x2)
 #define SAMD21_SPI_FLAG_XFER        (0x4)
+#define SAMD21_SPI_FLAG_DMA         (0x8)
 
 struct samd21_hal_spi {
     struct spi_module               module;
@@ -39,6 +45,21 @@ struct samd21_hal_spi {
 
     hal_spi_txrx_cb txrx_cb;
     void *txrx_cb_arg;
+
+#if MYNEWT_VAL(SPI_DMA)
+    /*
+     * One RX and one TX channel per SERCOM.  RX finishes last, so its
+     * completion ends the transfer.
+     */
+    struct dma_resource             dma_rx;
+    struct dma_resource             dma_tx;
+    COMPILER_ALIGNED(16) DmacDescriptor dma_rx_desc;
+    COMPILER_ALIGNED(16) DmacDescriptor dma_tx_desc;
+    struct os_sem                   dma_sem;
+    uint16_t                        dma_len;
+    uint16_t                        dma_rx_dummy;
+    volatile enum status_code       dma_status;
+#endif
 };
 
 #define HAL_SAMD21_SPI_MAX (6)
@@ -278,6 +299,77 @@ hal_spi_config(int spi_num, struct hal_spi_settings *settings)
     return 0;
 }
 
+#if MYNEWT_VAL(SPI_DMA)
+static void
+samd21_hal_spi_dma_done(struct dma_resource *resource)
+{
+    struct samd21_hal_spi *spi;
+
+    spi = (struct samd21_hal_spi *)
+          ((uint8_t *)resource - offsetof(struct samd21_hal_spi, dma_rx));
+
+    spi->dma_status = resource->job_status;
+
+    /*
+     * TX channel has no interrupt, so its job_status would stay busy;
+     * it is done by now anyway.
+     */
+    dma_abort_job(&spi->dma_tx);
+
+    if (spi->flags & SAMD21_SPI_FLAG_XFER) {
+        spi->flags &= ~SAMD21_SPI_FLAG_XFER;
+        if (spi->txrx_cb != NULL) {
+            spi->txrx_cb(spi->txrx_cb_arg, spi->dma_len);
+        } else {
+            os_sem_release(&spi->dma_sem);
+        }
+    }
+}
+
+/*
+ * Grab the two DMA channels this port needs.  If there aren't any left
+ * the port keeps working, just without DMA.
+ */
+static void
+samd21_hal_spi_dma_init(struct samd21_hal_spi *spi, int spi_num)
+{
+    struct dma_resource_config cfg;
+
+    if (spi->flags & SAMD21_SPI_FLAG_DMA) {
+        return;
+    }
+
+    samd21_dma_init();
+
+    dma_get_config_defaults(&cfg);
+    cfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+
+    /* Drain RX ahead of TX so the receiver never overflows */
+    cfg.priority = DMA_PRIORITY_LEVEL_1;
+    cfg.peripheral_trigger = SERCOM0_DMAC_ID_RX + 2 * spi_num;
+    if (dma_allocate(&spi->dma_rx, &cfg) != STATUS_OK) {
+        return;
+    }
+
+    cfg.priority = DMA_PRIORITY_LEVEL_0;
+    cfg.peripheral_trigger = SERCOM0_DMAC_ID_TX + 2 * spi_num;
+    if (dma_allocate(&spi->dma_tx, &cfg) != STATUS_OK) {
+        dma_free(&spi->dma_rx);
+        return;
+    }
+
+    dma_register_callback(&spi->dma_rx, samd21_hal_spi_dma_done,
+                          DMA_CALLBACK_TRANSFER_DONE);
+    dma_register_callback(&spi->dma_rx, samd21_hal_spi_dma_done,
+                          DMA_CALLBACK_TRANSFER_ERROR);
+    dma_enable_callback(&spi->dma_rx, DMA_CALLBACK_TRANSFER_DONE);
+    dma_enable_callback(&spi->dma_rx, DMA_CALLBACK_TRANSFER_ERROR);
+
+    os_sem_init(&spi->dma_sem, 0);
+    spi->flags |= SAMD21_SPI_FLAG_DMA;
+}
+#endif
+
 int
 hal_spi_enable(int spi_num)
 {
@@ -288,6 +380,10 @@ hal_spi_enable(int spi_num)
         return EINVAL;
     }
 
+#if MYNEWT_VAL(SPI_DMA)
+    samd21_hal_spi_dma_init(spi, spi_num);
+#endif
+
     /* Configure and initialize software device instance of peripheral slave */
     spi_enable(&spi->module);
     spi->flags |= SAMD21_SPI_FLAG_ENABLED;
@@ -406,6 +502,96 @@ samd21_hal_spi_txrx_nonblocking(struct samd21_hal_spi *spi, void *txbuf,
     return samd21_hal_spi_rc_from_status(status);
 }
 
+#if MYNEWT_VAL(SPI_DMA)
+/*
+ * Blocking DMA transfers sleep on a semaphore, which is only possible from
+ * task context with interrupts enabled.
+ */
+static int
+samd21_hal_spi_dma_can_block(void)
+{
+    return os_started() && __get_IPSR() == 0 && __get_PRIMASK() == 0;
+}
+
+static int
+samd21_hal_spi_txrx_dma(struct samd21_hal_spi *spi, void *txbuf,
+                        void *rxbuf, uint16_t len)
+{
+    struct dma_descriptor_config cfg;
+    enum dma_beat_size beat_size;
+    enum status_code status;
+    SercomSpi *hw;
+    uint32_t nbytes;
+
+    hw = &spi->module.hw->SPI;
+    if (spi->module.character_size == SPI_CHARACTER_SIZE_9BIT) {
+        beat_size = DMA_BEAT_SIZE_HWORD;
+        nbytes = len * 2;
+    } else {
+        beat_size = DMA_BEAT_SIZE_BYTE;
+        nbytes = len;
+    }
+
+    /*
+     * DMAC wants the address one past the last beat when incrementing.
+     * Reads nobody asked for land in a scratch word.
+     */
+    dma_descriptor_get_config_defaults(&cfg);
+    cfg.beat_size = beat_size;
+    cfg.block_action = DMA_BLOCK_ACTION_INT;
+    cfg.block_transfer_count = len;
+    cfg.src_increment_enable = false;
+    cfg.source_address = (uint32_t)&hw->DATA.reg;
+    if (rxbuf != NULL) {
+        cfg.destination_address = (uint32_t)rxbuf + nbytes;
+    } else {
+        cfg.dst_increment_enable = false;
+        cfg.destination_address = (uint32_t)&spi->dma_rx_dummy;
+    }
+    dma_descriptor_create(&spi->dma_rx_desc, &cfg);
+    dma_update_descriptor(&spi->dma_rx, &spi->dma_rx_desc);
+
+    dma_descriptor_get_config_defaults(&cfg);
+    cfg.beat_size = beat_size;
+    cfg.block_transfer_count = len;
+    cfg.dst_increment_enable = false;
+    cfg.source_address = (uint32_t)txbuf + nbytes;
+    cfg.destination_address = (uint32_t)&hw->DATA.reg;
+    dma_descriptor_create(&spi->dma_tx_desc, &cfg);
+    dma_update_descriptor(&spi->dma_tx, &spi->dma_tx_desc);
+
+    /* Throw away anything left over from earlier PIO traffic */
+    while (hw->INTFLAG.reg & SERCOM_SPI_INTFLAG_RXC) {
+        (void)hw->DATA.reg;
+    }
+    hw->STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+
+    spi->dma_len = len;
+    spi->dma_status = STATUS_BUSY;
+    spi->flags |= SAMD21_SPI_FLAG_XFER;
+
+    status = dma_start_transfer_job(&spi->dma_rx);
+    if (status == STATUS_OK) {
+        status = dma_start_transfer_job(&spi->dma_tx);
+        if (status != STATUS_OK) {
+            dma_abort_job(&spi->dma_rx);
+        }
+    }
+    if (status != STATUS_OK) {
+        spi->flags &= ~SAMD21_SPI_FLAG_XFER;
+        return samd21_hal_spi_rc_from_status(status);
+    }
+
+    if (spi->txrx_cb != NULL) {
+        return 0;
+    }
+
+    os_sem_pend(&spi->dma_sem, OS_TIMEOUT_NEVER);
+
+    return samd21_hal_spi_rc_from_status(spi->dma_status);
+}
+#endif
+
 int
 hal_spi_txrx(int spi_num, void *txbuf, void *rxbuf, int len)
 {
@@ -435,6 +621,14 @@ hal_spi_txrx(int spi_num, void *txbuf, void *rxbuf, int len)
         }
     }
 
+#if MYNEWT_VAL(SPI_DMA)
+    if ((spi->flags & SAMD21_SPI_FLAG_DMA) && txbuf != NULL &&
+        len >= MYNEWT_VAL(SPI_DMA_THRESHOLD) &&
+        (spi->txrx_cb != NULL || samd21_hal_spi_dma_can_block())) {
+        return samd21_hal_spi_txrx_dma(spi, txbuf, rxbuf, len);
+    }
+#endif
+
     if (spi->txrx_cb == NULL) {
         rc = samd21_hal_spi_txrx_blocking(spi, txbuf, rxbuf, len);
     } else {
@@ -469,12 +663,33 @@ int
 hal_spi_abort(int spi_num)
 {
     struct samd21_hal_spi *spi;
+#if MYNEWT_VAL(SPI_DMA)
+    os_sr_t sr;
+    int dma_busy;
+#endif
 
     spi = samd21_hal_spi_resolve(spi_num);
     if (spi == NULL) {
         return EINVAL;
     }
 
+#if MYNEWT_VAL(SPI_DMA)
+    if (spi->flags & SAMD21_SPI_FLAG_DMA) {
+        OS_ENTER_CRITICAL(sr);
+        dma_busy = dma_get_job_status(&spi->dma_rx) == STATUS_BUSY;
+        dma_abort_job(&spi->dma_tx);
+        dma_abort_job(&spi->dma_rx);
+        if (dma_busy && (spi->flags & SAMD21_SPI_FLAG_XFER)) {
+            /* Wake up blocking caller of DMA transfer */
+            spi->flags &= ~SAMD21_SPI_FLAG_XFER;
+            spi->dma_status = STATUS_ABORTED;
+            if (spi->txrx_cb == NULL) {
+                os_sem_release(&spi->dma_sem);
+            }
+        }
+        OS_EXIT_CRITICAL(sr);
+    }
+#endif
     spi_abort_job(&spi->module);
     spi->flags &= ~SAMD21_SPI_FLAG_XFER;
 
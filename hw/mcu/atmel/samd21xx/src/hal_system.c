@@ -16,11 +16,22 @@
 
 #include <mcu/cortex_m0.h>
 #include "hal/hal_system.h"
+#include "mcu/hal_flash.h"
 #include <stdlib.h>
 
 void
 hal_system_reset(void)
 {
+    /*
+     * Write out flash page held back by write combining, e.g. the tail of
+     * an image upload. Not from a fault or other handler, or with
+     * interrupts off; queued asynchronous flash operations could not
+     * finish, and waiting for them sleeps.
+     */
+    if (__get_IPSR() == 0 && __get_PRIMASK() == 0) {
+        samd21_flash_flush();
+    }
+
     while (1) {
         if (hal_debugger_connected()) {
             /*
@@ -35,16 +35,25 @@ typedef void (*hal_timer_irq_handler_t)(void);
 /* Number of timers for HAL */
 #define SAMD21_HAL_TIMER_MAX    (3)
 
+/* Max number of running timers per HAL timer, if queue is a heap */
+#define SAMD21_HAL_TIMER_HEAP_SIZE  MYNEWT_VAL(TIMER_HEAP_SIZE)
+
 /* Internal timer data structure */
 struct samd21_hal_timer {
     uint8_t tmr_enabled;
     uint8_t tmr_irq_num;
     uint8_t tmr_srcclk;
     uint8_t tmr_initialized;
+    uint8_t tmr_32bit;          /* TC4+TC5 as one 32-bit counter */
     uint32_t tmr_cntr;
     uint32_t timer_isrs;
     uint32_t tmr_freq;
+#if SAMD21_HAL_TIMER_HEAP_SIZE > 0
+    uint16_t tmr_heap_cnt;
+    struct hal_timer *tmr_heap[SAMD21_HAL_TIMER_HEAP_SIZE];
+#else
     TAILQ_HEAD(hal_timer_qhead, hal_timer) hal_timer_q;
+#endif
     struct tc_module tc_mod;
     enum gclk_generator tmr_clkgen;
 };
@@ -89,6 +98,140 @@ static const struct samd21_hal_timer *samd21_hal_timers[SAMD21_HAL_TIMER_MAX] =
         goto err;                               \
     }
 
+#if SAMD21_HAL_TIMER_HEAP_SIZE > 0
+/*
+ * Running timers are kept in a binary min-heap ordered by expiry, so
+ * insert and remove are O(log n). Link in struct hal_timer is reused:
+ * tqe_prev points to the heap slot holding the timer. It is non-NULL
+ * while timer is queued, like with the list.
+ */
+static inline int
+samd21_timer_before(struct hal_timer *a, struct hal_timer *b)
+{
+    return (int32_t)(a->expiry - b->expiry) < 0;
+}
+
+static inline void
+samd21_timer_heap_set(struct samd21_hal_timer *bsptimer, int idx,
+                      struct hal_timer *timer)
+{
+    bsptimer->tmr_heap[idx] = timer;
+    timer->link.tqe_prev = &bsptimer->tmr_heap[idx];
+}
+
+static void
+samd21_timer_heap_up(struct samd21_hal_timer *bsptimer, int idx)
+{
+    struct hal_timer *timer = bsptimer->tmr_heap[idx];
+    int parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (!samd21_timer_before(timer, bsptimer->tmr_heap[parent])) {
+            break;
+        }
+        samd21_timer_heap_set(bsptimer, idx, bsptimer->tmr_heap[parent]);
+        idx = parent;
+    }
+    samd21_timer_heap_set(bsptimer, idx, timer);
+}
+
+static void
+samd21_timer_heap_down(struct samd21_hal_timer *bsptimer, int idx)
+{
+    struct hal_timer *timer = bsptimer->tmr_heap[idx];
+    int cnt = bsptimer->tmr_heap_cnt;
+    int child;
+
+    while ((child = 2 * idx + 1) < cnt) {
+        if (child + 1 < cnt && samd21_timer_before(bsptimer->tmr_heap[child + 1],
+                                                   bsptimer->tmr_heap[child])) {
+            child++;
+        }
+        if (!samd21_timer_before(bsptimer->tmr_heap[child], timer)) {
+            break;
+        }
+        samd21_timer_heap_set(bsptimer, idx, bsptimer->tmr_heap[child]);
+        idx = child;
+    }
+    samd21_timer_heap_set(bsptimer, idx, timer);
+}
+
+static inline struct hal_timer *
+samd21_timer_first(struct samd21_hal_timer *bsptimer)
+{
+    return bsptimer->tmr_heap_cnt ? bsptimer->tmr_heap[0] : NULL;
+}
+
+static int
+samd21_timer_insert(struct samd21_hal_timer *bsptimer, struct hal_timer *timer)
+{
+    int idx;
+
+    if (bsptimer->tmr_heap_cnt >= SAMD21_HAL_TIMER_HEAP_SIZE) {
+        return ENOMEM;
+    }
+    idx = bsptimer->tmr_heap_cnt++;
+    bsptimer->tmr_heap[idx] = timer;
+    samd21_timer_heap_up(bsptimer, idx);
+    return 0;
+}
+
+static void
+samd21_timer_remove(struct samd21_hal_timer *bsptimer, struct hal_timer *timer)
+{
+    struct hal_timer *last;
+    int idx;
+
+    idx = timer->link.tqe_prev - bsptimer->tmr_heap;
+    timer->link.tqe_prev = NULL;
+    last = bsptimer->tmr_heap[--bsptimer->tmr_heap_cnt];
+    if (last == timer) {
+        return;
+    }
+    bsptimer->tmr_heap[idx] = last;
+    if (idx > 0 && samd21_timer_before(last, bsptimer->tmr_heap[(idx - 1) / 2])) {
+        samd21_timer_heap_up(bsptimer, idx);
+    } else {
+        samd21_timer_heap_down(bsptimer, idx);
+    }
+}
+#else
+static inline struct hal_timer *
+samd21_timer_first(struct samd21_hal_timer *bsptimer)
+{
+    return TAILQ_FIRST(&bsptimer->hal_timer_q);
+}
+
+static int
+samd21_timer_insert(struct samd21_hal_timer *bsptimer, struct hal_timer *timer)
+{
+    struct hal_timer *entry;
+
+    if (TAILQ_EMPTY(&bsptimer->hal_timer_q)) {
+        TAILQ_INSERT_HEAD(&bsptimer->hal_timer_q, timer, link);
+    } else {
+        TAILQ_FOREACH(entry, &bsptimer->hal_timer_q, link) {
+            if ((int32_t)(timer->expiry - entry->expiry) < 0) {
+                TAILQ_INSERT_BEFORE(entry, timer, link);
+                break;
+            }
+        }
+        if (!entry) {
+            TAILQ_INSERT_TAIL(&bsptimer->hal_timer_q, timer, link);
+        }
+    }
+    return 0;
+}
+
+static void
+samd21_timer_remove(struct samd21_hal_timer *bsptimer, struct hal_timer *timer)
+{
+    TAILQ_REMOVE(&bsptimer->hal_timer_q, timer, link);
+    timer->link.tqe_prev = NULL;
+}
+#endif
+
 /**
  * samd21 timer set ocmp
  *
@@ -111,6 +254,18 @@ samd21_timer_set_ocmp(struct samd21_hal_timer *bsptimer, uint32_t expiry)
     /* Disable ocmp interrupt and set new value */
     hwtimer->COUNT16.INTENCLR.reg = TC_INTENCLR_MC0;
 
+    if (bsptimer->tmr_32bit) {
+        /* Counter is as wide as expiry; program compare directly */
+        tc_set_compare_value(&bsptimer->tc_mod, TC_COMPARE_CAPTURE_CHANNEL_0,
+                             expiry);
+        hwtimer->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+        hwtimer->COUNT32.INTENSET.reg = TC_INTENSET_MC0;
+        if ((int32_t)(tc_get_count_value(&bsptimer->tc_mod) - expiry) >= 0) {
+            goto set_ocmp_late;
+        }
+        return;
+    }
+
     temp = expiry & 0xffff0000;
     delta_t = (int32_t)(temp - bsptimer->tmr_cntr);
     if (delta_t < 0) {
@@ -156,6 +311,10 @@ hal_timer_read_bsptimer(struct samd21_hal_timer *bsptimer)
     uint32_t tcntr;
     Tc *hwtimer;
 
+    if (bsptimer->tmr_32bit) {
+        return tc_get_count_value(&bsptimer->tc_mod);
+    }
+
     hwtimer = bsptimer->tc_mod.hw;
     cpu_irq_enter_critical();
     tcntr = bsptimer->tmr_cntr;
@@ -189,19 +348,24 @@ hal_timer_chk_queue(struct samd21_hal_timer *bsptimer)
     /* disable interrupts */
     cpu_irq_enter_critical();
 
-    while ((timer = TAILQ_FIRST(&bsptimer->hal_timer_q)) != NULL) {
-        tcntr = hal_timer_read_bsptimer(bsptimer);
-        if ((int32_t)(tcntr - timer->expiry) >= 0) {
-            TAILQ_REMOVE(&bsptimer->hal_timer_q, timer, link);
-            timer->link.tqe_prev = NULL;
-            timer->cb_func(timer->cb_arg);
-        } else {
-            break;
+    /*
+     * Counter is read again only when head doesn't look expired; time
+     * might have passed while running callbacks.
+     */
+    tcntr = hal_timer_read_bsptimer(bsptimer);
+    while ((timer = samd21_timer_first(bsptimer)) != NULL) {
+        if ((int32_t)(tcntr - timer->expiry) < 0) {
+            tcntr = hal_timer_read_bsptimer(bsptimer);
+            if ((int32_t)(tcntr - timer->expiry) < 0) {
+                break;
+            }
         }
+        samd21_timer_remove(bsptimer, timer);
+        timer->cb_func(timer->cb_arg);
     }
 
     /* Any timers left on queue? If so, we need to set OCMP */
-    timer = TAILQ_FIRST(&bsptimer->hal_timer_q);
+    timer = samd21_timer_first(bsptimer);
     if (timer) {
         samd21_timer_set_ocmp(bsptimer, timer->expiry);
     } else {
@@ -317,6 +481,15 @@ hal_timer_init(int timer_num, void *cfg)
     }
     tmr_cfg = (struct samd21_timer_cfg *)cfg;
 
+#if MYNEWT_VAL(TIMER_COUNT32)
+    /* TC5 is the upper half of the counter on TC4 */
+    if (tmr_cfg->hwtimer == TC5) {
+        rc = EINVAL;
+        goto err;
+    }
+    bsptimer->tmr_32bit = (tmr_cfg->hwtimer == TC4);
+#endif
+
     rc = 0;
     switch (timer_num) {
 #if MYNEWT_VAL(TIMER_0)
@@ -434,7 +607,11 @@ hal_timer_config(int timer_num, uint32_t freq_hz)
     }
 
     /* Set up timer counter. Need to determine prescaler */
-    cfg.counter_size = TC_COUNTER_SIZE_16BIT;
+    if (bsptimer->tmr_32bit) {
+        cfg.counter_size = TC_COUNTER_SIZE_32BIT;
+    } else {
+        cfg.counter_size = TC_COUNTER_SIZE_16BIT;
+    }
 
     if (div == 1) {
         prescaler = 0;
@@ -468,7 +645,10 @@ hal_timer_config(int timer_num, uint32_t freq_hz)
 
     tc_rc = tc_init(&bsptimer->tc_mod, bsptimer->tc_mod.hw, &cfg);
     if (tc_rc == STATUS_OK) {
-        bsptimer->tc_mod.hw->COUNT16.INTENSET.reg = TC_INTFLAG_OVF;
+        /* 16-bit counter is extended in software on overflow */
+        if (!bsptimer->tmr_32bit) {
+            bsptimer->tc_mod.hw->COUNT16.INTENSET.reg = TC_INTFLAG_OVF;
+        }
         tc_enable(&bsptimer->tc_mod);
     } else {
         rc = EINVAL;
@@ -636,8 +816,8 @@ hal_timer_start(struct hal_timer *timer, uint32_t ticks)
 int
 hal_timer_start_at(struct hal_timer *timer, uint32_t tick)
 {
-    struct hal_timer *entry;
     struct samd21_hal_timer *bsptimer;
+    int rc;
 
     if ((timer == NULL) || (timer->link.tqe_prev != NULL) ||
         (timer->cb_func == NULL)) {
@@ -648,28 +828,16 @@ hal_timer_start_at(struct hal_timer *timer, uint32_t tick)
 
     cpu_irq_enter_critical();
 
-    if (TAILQ_EMPTY(&bsptimer->hal_timer_q)) {
-        TAILQ_INSERT_HEAD(&bsptimer->hal_timer_q, timer, link);
-    } else {
-        TAILQ_FOREACH(entry, &bsptimer->hal_timer_q, link) {
-            if ((int32_t)(timer->expiry - entry->expiry) < 0) {
-                TAILQ_INSERT_BEFORE(entry, timer, link);
-                break;
-            }
-        }
-        if (!entry) {
-            TAILQ_INSERT_TAIL(&bsptimer->hal_timer_q, timer, link);
-        }
-    }
+    rc = samd21_timer_insert(bsptimer, timer);
 
     /* If this is the head, we need to set new OCMP */
-    if (timer == TAILQ_FIRST(&bsptimer->hal_timer_q)) {
+    if (rc == 0 && timer == samd21_timer_first(bsptimer)) {
         samd21_timer_set_ocmp(bsptimer, timer->expiry);
     }
 
     cpu_irq_leave_critical();
 
-    return 0;
+    return rc;
 }
 
 /**
@@ -697,15 +865,11 @@ hal_timer_stop(struct hal_timer *timer)
     cpu_irq_enter_critical();
 
     if (timer->link.tqe_prev != NULL) {
-        reset_ocmp = 0;
-        if (timer == TAILQ_FIRST(&bsptimer->hal_timer_q)) {
-            /* If first on queue, we will need to reset OCMP */
-            entry = TAILQ_NEXT(timer, link);
-            reset_ocmp = 1;
-        }
-        TAILQ_REMOVE(&bsptimer->hal_timer_q, timer, link);
-        timer->link.tqe_prev = NULL;
+        /* If first on queue, we will need to reset OCMP */
+        reset_ocmp = (timer == samd21_timer_first(bsptimer));
+        samd21_timer_remove(bsptimer, timer);
         if (reset_ocmp) {
+            entry = samd21_timer_first(bsptimer);
             if (entry) {
                 samd21_timer_set_ocmp((struct samd21_hal_timer *)entry->bsp_timer,
                                       entry->expiry);
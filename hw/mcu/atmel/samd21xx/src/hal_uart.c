@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include "syscfg/syscfg.h"
 #include "hal/hal_uart.h"
 #include "hal/hal_gpio.h"
 #include "mcu/cmsis_nvic.h"
@@ -24,9 +25,20 @@
 #include <usart.h>
 #include "usart_interrupt.h"
 #include <mcu/hal_uart.h>
+#if MYNEWT_VAL(UART_DMA)
+#include <os/os_cputime.h>
+#include "compiler.h"
+#include "sam0/drivers/dma/dma.h"
+#include "common/utils/interrupt/interrupt_sam_nvic.h"
+#include "samd21_priv.h"
+#endif
 
 #define UART_CNT    (SERCOM_INST_NUM)
+#if MYNEWT_VAL(UART_DMA)
+#define TX_BUFFER_SIZE  MYNEWT_VAL(UART_DMA_TX_BUF_SIZE)
+#else
 #define TX_BUFFER_SIZE  (8)
+#endif
 
 struct hal_uart {
     struct usart_module instance;   /* must be at top */
@@ -39,9 +51,38 @@ struct hal_uart {
     hal_uart_tx_done u_tx_done;
     void *u_func_arg;
     const struct samd21_uart_config *u_cfg;
+#if MYNEWT_VAL(UART_DMA)
+    /*
+     * DMA receive. Each half of rx_buf has its own descriptor, and the
+     * two are linked in a loop. rx_tail is the next byte to hand out.
+     */
+    uint8_t *rx_buf;
+    uint16_t rx_half_len;
+    uint16_t rx_tail;
+    uint16_t rx_last;       /* DMA position at previous idle check */
+    uint8_t rx_half;        /* half DMA is filling */
+    uint8_t rx_dma_on:1;
+    uint8_t rx_dma_alloc:1;
+    samd21_uart_rx_block u_rx_blk;
+    struct hal_timer rx_timer;
+    struct dma_resource rx_dma;
+    COMPILER_ALIGNED(16) DmacDescriptor rx_desc[2];
+
+    /*
+     * DMA transmit, used both for txdata and for samd21_uart_tx_dma().
+     * u_tx_blk is set while the latter is in progress.
+     */
+    uint8_t tx_dma_alloc:1;
+    uint8_t tx_pend:1;      /* hal_uart_start_tx() called meanwhile */
+    samd21_uart_tx_done u_tx_blk;
+    struct dma_resource tx_dma;
+    COMPILER_ALIGNED(16) DmacDescriptor tx_desc;
+#endif
 };
 static struct hal_uart uarts[UART_CNT];
 
+static int hal_uart_tx_buf(struct hal_uart *u, uint8_t *buf, int len);
+
 static int fill_tx_buf(struct hal_uart *u) {
     int i;
 
@@ -70,7 +111,9 @@ usart_callback_txdone(struct usart_module *const module) {
 
     if(sz > 0) {
         u->tx_on=1;
-        usart_write_buffer_job(&u->instance, u->txdata, sz);
+        if (hal_uart_tx_buf(u, u->txdata, sz)) {
+            u->tx_on = 0;
+        }
     } else {
         u->tx_on = 0;
         if(u->u_tx_done) {
@@ -93,6 +136,366 @@ usart_callback_rx(struct usart_module *const module) {
     usart_read_job(&u->instance, (uint16_t*) &u->rxdata);
 }
 
+#if MYNEWT_VAL(UART_DMA)
+static void
+hal_uart_rx_deliver(struct hal_uart *u, int end)
+{
+    uint8_t *data;
+    int len;
+    int i;
+
+    data = u->rx_buf + u->rx_tail;
+    len = end - u->rx_tail;
+    u->rx_tail = end;
+    if (len <= 0) {
+        return;
+    }
+    if (u->u_rx_blk) {
+        u->u_rx_blk(u->u_func_arg, data, len);
+    } else if (u->u_rx_func) {
+        for (i = 0; i < len; i++) {
+            u->u_rx_func(u->u_func_arg, data[i]);
+        }
+    }
+}
+
+static struct hal_uart *
+hal_uart_from_rx_dma(struct dma_resource *resource)
+{
+    int i;
+
+    for (i = 0; i < UART_CNT; i++) {
+        if (&uarts[i].rx_dma == resource) {
+            return &uarts[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Half of the buffer has been filled.
+ */
+static void
+hal_uart_rx_dma_done(struct dma_resource *resource)
+{
+    struct hal_uart *u;
+    int end;
+
+    u = hal_uart_from_rx_dma(resource);
+    if (!u || !u->u_open) {
+        return;
+    }
+    end = (u->rx_half + 1) * u->rx_half_len;
+    hal_uart_rx_deliver(u, end);
+    if (u->rx_half) {
+        u->rx_tail = 0;
+    }
+    u->rx_half ^= 1;
+}
+
+/*
+ * Where DMA is at in rx_buf, according to the write-back descriptor.
+ * Returns -1 if it's not in the half we think is being filled; the
+ * half/full interrupt is then pending, and will take care of the data.
+ */
+static int
+hal_uart_rx_dma_pos(struct hal_uart *u)
+{
+    DmacDescriptor *wb;
+    uint32_t next;
+    int left;
+    int half;
+
+    wb = (DmacDescriptor *)DMAC->WRBADDR.reg + u->rx_dma.channel_id;
+    do {
+        next = wb->DESCADDR.reg;
+        left = wb->BTCNT.reg;
+    } while (next != wb->DESCADDR.reg);
+
+    /* Descriptor being executed links to the other one */
+    if (next == (uint32_t)&u->rx_desc[1]) {
+        half = 0;
+    } else if (next == (uint32_t)&u->rx_desc[0]) {
+        half = 1;
+    } else {
+        return -1;
+    }
+    if (half != u->rx_half) {
+        return -1;
+    }
+    return half * u->rx_half_len + u->rx_half_len - left;
+}
+
+/*
+ * Start bit seen while the line was idle. Keep checking DMA progress
+ * until it stops moving.
+ */
+static void
+hal_uart_rx_start(struct usart_module *const module)
+{
+    struct hal_uart *u = (struct hal_uart *)module;
+    int pos;
+
+    pos = hal_uart_rx_dma_pos(u);
+    u->rx_last = pos < 0 ? u->rx_tail : pos;
+    os_cputime_timer_relative(&u->rx_timer, MYNEWT_VAL(UART_DMA_RX_IDLE_US));
+}
+
+static void
+hal_uart_rx_idle(void *arg)
+{
+    struct hal_uart *u = (struct hal_uart *)arg;
+    SercomUsart *su = &u->instance.hw->USART;
+    int pos;
+
+    if (!u->u_open) {
+        return;
+    }
+    cpu_irq_enter_critical();
+    pos = hal_uart_rx_dma_pos(u);
+    if (pos < 0 || pos != u->rx_last ||
+      (su->INTFLAG.reg & SERCOM_USART_INTFLAG_RXS)) {
+        /* Still receiving */
+        su->INTFLAG.reg = SERCOM_USART_INTFLAG_RXS;
+        u->rx_last = pos < 0 ? u->rx_tail : pos;
+        cpu_irq_leave_critical();
+        os_cputime_timer_relative(&u->rx_timer,
+          MYNEWT_VAL(UART_DMA_RX_IDLE_US));
+        return;
+    }
+    hal_uart_rx_deliver(u, pos);
+
+    /*
+     * Wait for the next start bit. If one came in after the check above,
+     * the flag is set, and interrupt fires right away.
+     */
+    su->INTENSET.reg = SERCOM_USART_INTENSET_RXS;
+    cpu_irq_leave_critical();
+}
+
+static int
+hal_uart_rx_dma_start(struct hal_uart *u)
+{
+    struct dma_resource_config dcfg;
+    struct dma_descriptor_config cfg;
+    SercomUsart *su = &u->instance.hw->USART;
+    int i;
+
+    if (u->rx_dma_on) {
+        return 0;
+    }
+    if (!u->rx_dma_alloc) {
+        samd21_dma_init();
+
+        dma_get_config_defaults(&dcfg);
+        dcfg.peripheral_trigger = SERCOM0_DMAC_ID_RX +
+          2 * _sercom_get_sercom_inst_index(u->u_cfg->suc_sercom);
+        dcfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+        dcfg.priority = DMA_PRIORITY_LEVEL_2;
+        if (dma_allocate(&u->rx_dma, &dcfg) != STATUS_OK) {
+            return -1;
+        }
+        dma_register_callback(&u->rx_dma, hal_uart_rx_dma_done,
+                              DMA_CALLBACK_TRANSFER_DONE);
+        dma_enable_callback(&u->rx_dma, DMA_CALLBACK_TRANSFER_DONE);
+        os_cputime_timer_init(&u->rx_timer, hal_uart_rx_idle, u);
+        u->rx_dma_alloc = 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        dma_descriptor_get_config_defaults(&cfg);
+        cfg.beat_size = DMA_BEAT_SIZE_BYTE;
+        cfg.src_increment_enable = false;
+        cfg.block_transfer_count = u->rx_half_len;
+        cfg.source_address = (uint32_t)&su->DATA.reg;
+        /* destination is the end address when incrementing */
+        cfg.destination_address =
+          (uint32_t)(u->rx_buf + (i + 1) * u->rx_half_len);
+        cfg.next_descriptor_address = (uint32_t)&u->rx_desc[i ^ 1];
+        cfg.block_action = DMA_BLOCK_ACTION_INT;
+        dma_descriptor_create(&u->rx_desc[i], &cfg);
+    }
+    dma_update_descriptor(&u->rx_dma, &u->rx_desc[0]);
+    u->rx_tail = 0;
+    u->rx_half = 0;
+    if (dma_start_transfer_job(&u->rx_dma) != STATUS_OK) {
+        return -1;
+    }
+    u->rx_dma_on = 1;
+
+    su->INTFLAG.reg = SERCOM_USART_INTFLAG_RXS;
+    su->INTENSET.reg = SERCOM_USART_INTENSET_RXS;
+    return 0;
+}
+
+static void
+hal_uart_rx_dma_stop(struct hal_uart *u)
+{
+    if (!u->rx_dma_on) {
+        return;
+    }
+    u->instance.hw->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_RXS;
+    os_cputime_timer_stop(&u->rx_timer);
+    dma_abort_job(&u->rx_dma);
+    u->rx_dma_on = 0;
+}
+
+int
+samd21_uart_rx_dma(int port, uint8_t *buf, int len,
+                   samd21_uart_rx_block rx_blk)
+{
+    struct hal_uart *u;
+
+    if (port >= UART_CNT || !buf || len < 2 || (len & 1) ||
+        len > 2 * UINT16_MAX) {
+        return -1;
+    }
+    u = &uarts[port];
+    if (u->u_open) {
+        return -1;
+    }
+    u->rx_buf = buf;
+    u->rx_half_len = len / 2;
+    u->u_rx_blk = rx_blk;
+    return 0;
+}
+
+static struct hal_uart *
+hal_uart_from_tx_dma(struct dma_resource *resource)
+{
+    int i;
+
+    for (i = 0; i < UART_CNT; i++) {
+        if (&uarts[i].tx_dma == resource) {
+            return &uarts[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Last character has been moved to DATA register.
+ */
+static void
+hal_uart_tx_dma_done(struct dma_resource *resource)
+{
+    struct hal_uart *u;
+    samd21_uart_tx_done done;
+
+    u = hal_uart_from_tx_dma(resource);
+    if (!u) {
+        return;
+    }
+    done = u->u_tx_blk;
+    if (!done) {
+        usart_callback_txdone(&u->instance);
+        return;
+    }
+    u->u_tx_blk = NULL;
+    u->tx_on = 0;
+    done(u->u_func_arg);
+
+    if (!u->tx_on && u->tx_pend) {
+        u->tx_pend = 0;
+        if (u->u_tx_func) {
+            usart_callback_txdone(&u->instance);
+        }
+    }
+}
+
+static int
+hal_uart_tx_dma_init(struct hal_uart *u)
+{
+    struct dma_resource_config dcfg;
+
+    if (u->tx_dma_alloc) {
+        return 0;
+    }
+    samd21_dma_init();
+
+    dma_get_config_defaults(&dcfg);
+    dcfg.peripheral_trigger = SERCOM0_DMAC_ID_TX +
+      2 * _sercom_get_sercom_inst_index(u->u_cfg->suc_sercom);
+    dcfg.trigger_action = DMA_TRIGGER_ACTON_BEAT;
+    if (dma_allocate(&u->tx_dma, &dcfg) != STATUS_OK) {
+        return -1;
+    }
+    dma_register_callback(&u->tx_dma, hal_uart_tx_dma_done,
+                          DMA_CALLBACK_TRANSFER_DONE);
+    dma_enable_callback(&u->tx_dma, DMA_CALLBACK_TRANSFER_DONE);
+    u->tx_dma_alloc = 1;
+    return 0;
+}
+
+static int
+hal_uart_tx_dma_job(struct hal_uart *u, const uint8_t *buf, int len)
+{
+    struct dma_descriptor_config cfg;
+
+    dma_descriptor_get_config_defaults(&cfg);
+    cfg.beat_size = DMA_BEAT_SIZE_BYTE;
+    cfg.dst_increment_enable = false;
+    cfg.block_transfer_count = len;
+    /* source is the end address when incrementing */
+    cfg.source_address = (uint32_t)(buf + len);
+    cfg.destination_address = (uint32_t)&u->instance.hw->USART.DATA.reg;
+    dma_descriptor_create(&u->tx_desc, &cfg);
+    dma_update_descriptor(&u->tx_dma, &u->tx_desc);
+    if (dma_start_transfer_job(&u->tx_dma) != STATUS_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+samd21_uart_tx_dma(int port, const uint8_t *data, int len,
+                   samd21_uart_tx_done done)
+{
+    struct hal_uart *u;
+
+    if (port >= UART_CNT || !data || len <= 0 || len > UINT16_MAX) {
+        return -1;
+    }
+    /* Completion without done would be taken for a tx_char block */
+    if (!done) {
+        return -1;
+    }
+    u = &uarts[port];
+    if (!u->u_open || !u->tx_dma_alloc) {
+        return -1;
+    }
+    cpu_irq_enter_critical();
+    if (u->tx_on) {
+        cpu_irq_leave_critical();
+        return -1;
+    }
+    u->tx_on = 1;
+    u->u_tx_blk = done;
+    cpu_irq_leave_critical();
+
+    if (hal_uart_tx_dma_job(u, data, len)) {
+        u->u_tx_blk = NULL;
+        u->tx_on = 0;
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+static int
+hal_uart_tx_buf(struct hal_uart *u, uint8_t *buf, int len)
+{
+#if MYNEWT_VAL(UART_DMA)
+    if (u->tx_dma_alloc) {
+        return hal_uart_tx_dma_job(u, buf, len);
+    }
+#endif
+    if (usart_write_buffer_job(&u->instance, buf, len) != STATUS_OK) {
+        return -1;
+    }
+    return 0;
+}
+
 int
 hal_uart_init_cbs(int port, hal_uart_tx_char tx_func, hal_uart_tx_done tx_done,
   hal_uart_rx_char rx_func, void *arg)
@@ -119,6 +522,12 @@ hal_uart_start_rx(int port)
     if (port >= UART_CNT || !u->u_open) {
         return;
     }
+#if MYNEWT_VAL(UART_DMA)
+    if (u->rx_buf) {
+        hal_uart_rx_dma_start(u);
+        return;
+    }
+#endif
     usart_read_job(&u->instance, (uint16_t*) &u->rxdata);
 }
 
@@ -133,6 +542,11 @@ hal_uart_start_tx(int port)
 
     if(u->tx_on) {
         /* we are already transmitting */
+#if MYNEWT_VAL(UART_DMA)
+        if (u->u_tx_blk) {
+            u->tx_pend = 1;
+        }
+#endif
         return;
     }
 
@@ -141,7 +555,9 @@ hal_uart_start_tx(int port)
         sz = fill_tx_buf(u);
         if(sz > 0) {
             u->tx_on=1;
-            usart_write_buffer_job(&u->instance, u->txdata, sz);
+            if (hal_uart_tx_buf(u, u->txdata, sz)) {
+                u->tx_on = 0;
+            }
         }
     }
 }
@@ -249,6 +665,16 @@ hal_uart_config(int port, int32_t baudrate, uint8_t databits, uint8_t stopbits,
     config_usart.pinmux_pad2       = samd21_cfg->suc_pad2;
     config_usart.pinmux_pad3       = samd21_cfg->suc_pad3;
 
+#if MYNEWT_VAL(UART_DMA)
+    if (uarts[port].rx_buf) {
+        if (databits == 9) {
+            return -1;
+        }
+        /* RXS interrupt tells when line stops being idle */
+        config_usart.start_frame_detection_enable = true;
+    }
+#endif
+
     /* Reset module */
     su = &samd21_cfg->suc_sercom->USART;
     su->CTRLA.reg &= ~SERCOM_USART_CTRLA_ENABLE;
@@ -273,6 +699,17 @@ hal_uart_config(int port, int32_t baudrate, uint8_t databits, uint8_t stopbits,
 
     usart_enable_callback(pinst, USART_CALLBACK_BUFFER_TRANSMITTED);
     usart_enable_callback(pinst, USART_CALLBACK_BUFFER_RECEIVED);
+#if MYNEWT_VAL(UART_DMA)
+    /* 9 bit characters take two bytes each; leave those to interrupts */
+    if (databits != 9 && hal_uart_tx_dma_init(&uarts[port])) {
+        return -1;
+    }
+    if (uarts[port].rx_buf) {
+        usart_register_callback(pinst, hal_uart_rx_start,
+                                USART_CALLBACK_START_RECEIVED);
+        usart_enable_callback(pinst, USART_CALLBACK_START_RECEIVED);
+    }
+#endif
     usart_enable(pinst);
     uarts[port].u_open = 1;
 
@@ -288,6 +725,13 @@ hal_uart_close(int port)
 
     usart_disable_callback(pinst, USART_CALLBACK_BUFFER_TRANSMITTED);
     usart_disable_callback(pinst, USART_CALLBACK_BUFFER_RECEIVED);
+#if MYNEWT_VAL(UART_DMA)
+    usart_disable_callback(pinst, USART_CALLBACK_START_RECEIVED);
+    hal_uart_rx_dma_stop(&uarts[port]);
+    if (uarts[port].tx_dma_alloc) {
+        dma_abort_job(&uarts[port].tx_dma);
+    }
+#endif
     usart_disable(pinst);
 
     return 0;
@@ -933,6 +933,11 @@ enum status_code spi_transceive_buffer_wait(
 			return retval;
 		}
 
+		/* Received data is discarded when there is no RX buffer */
+		if (rx_data == NULL) {
+			continue;
+		}
+
 		/* Read value will be at least 8-bits long */
 		rx_data[rx_pos++] = received_data;
 
@@ -20,6 +20,7 @@
 
 #include <stddef.h>
 
+#include "mcu/cmsis_nvic.h"
 #include "samd21_priv.h"
 
 static Sercom * const samd21_sercoms[SERCOM_INST_NUM] = SERCOM_INSTS;
@@ -33,3 +34,35 @@ samd21_sercom(int inst_num)
 
     return samd21_sercoms[inst_num];
 }
+
+/*
+ * The vector table lives in RAM, so the ASF DMAC handler has to be
+ * installed before the first DMA job is started.
+ */
+void
+samd21_dma_init(void)
+{
+    static uint8_t samd21_dma_inited;
+
+    if (!samd21_dma_inited) {
+        NVIC_SetVector(DMAC_IRQn, (uint32_t)DMAC_Handler);
+        samd21_dma_inited = 1;
+    }
+}
+
+/*
+ * ASF system_init() doesn't bring up the event system; do it when the
+ * first user allocates a channel.
+ */
+void _system_events_init(void);
+
+void
+samd21_events_init(void)
+{
+    static uint8_t samd21_events_inited;
+
+    if (!samd21_events_inited) {
+        _system_events_init();
+        samd21_events_inited = 1;
+    }
+}
@@ -24,5 +24,7 @@
 #include "mcu/samd21.h"
 
 Sercom *samd21_sercom(int inst_num);
+void samd21_dma_init(void);
+void samd21_events_init(void);
 
 #endif
@@ -13,6 +13,7 @@
  */
 #include <stdint.h>
 #include <stdbool.h>
+#include <os/os.h>
 
 #define ESP_TIMEOUT 2000
 
@@ -87,7 +88,9 @@ bool esp_ready(void);
 void esp_reset(void);
 
 /*
- * Transmit request, data is CRC'd while sending.
+ * Transmit request, data is CRC'd while sending. Transmit is locked from
+ * esp_request_start() until esp_request_end(), so tasks can send requests
+ * concurrently; frame must always be finished with esp_request_end().
  */
 uint16_t esp_request_start(uint16_t cmd, esp_req_cb callback, uint32_t _return,
   uint16_t argc);
@@ -96,7 +99,9 @@ void esp_request_end(uint16_t crc);
 
 /*
  * Data from ESPLink is read within esp_process().
- * esp_wait_return() and esp_wait_return_timo() call esp_process() internally.
+ * esp_wait_return() and esp_wait_return_timo() call esp_process() internally,
+ * unless received data is processed from an event queue. It is safe to call
+ * from several tasks; one at a time gets to process the data.
  */
 void esp_process(void);
 bool esp_wait_return(uint32_t *ret_value);
@@ -109,4 +114,63 @@ bool esp_wait_return_timo(int32_t timeout, uint32_t *ret_value);
  */
 void esp_wait_for(uint16_t cmd, esp_req_cb callback);
 
+/*
+ * Received data is processed from this event queue, instead of by the
+ * task waiting for a response. Task servicing the queue must not wait
+ * for responses itself.
+ */
+void espduino_evq_set(struct os_eventq *evq);
+
+/*
+ * Tracked request. The callback field of request carries a token, which
+ * ESPLink echoes back in the response; that's how the response is matched
+ * to request, so several can be outstanding at the same time.
+ *
+ * When response arrives, _return is stored in er_return, and first
+ * argument is copied to er_buf (if set). Then er_done is called, or if
+ * there is none, esp_req_wait() returns. er_done runs in the task which
+ * processes received data, and the response is valid only during the call.
+ */
+struct esp_req;
+typedef void (*esp_req_done_t)(struct esp_req *req, struct PACKET_CMD *resp);
+
+struct esp_req {
+    esp_req_done_t er_done;
+    void *er_arg;
+    uint8_t *er_buf;
+    uint16_t er_buf_size;
+    uint16_t er_len;                /* bytes copied to er_buf */
+    uint32_t er_return;
+
+    /* internal */
+    uint32_t er_token;
+    uint8_t er_pending;
+    volatile uint8_t er_complete;
+    struct os_sem er_sem;
+    TAILQ_ENTRY(esp_req) er_next;
+};
+
+void esp_req_init(struct esp_req *req, esp_req_done_t done, void *arg);
+
+/*
+ * Starts transmitting request with req as the token. Continue with
+ * esp_request_cont() and esp_request_end(), which releases transmit lock.
+ */
+uint16_t esp_req_start(struct esp_req *req, uint16_t cmd, uint32_t _return,
+  uint16_t argc);
+
+/*
+ * Makes req receive the next response with given token, without sending
+ * a request. For responses which carry the token of an earlier request,
+ * like REST responses do.
+ */
+void esp_req_arm(struct esp_req *req, uint32_t token);
+
+/*
+ * Waits for response to req. Returns 0 when one arrived, -1 on timeout,
+ * in which case request is no longer tracked.
+ */
+int esp_req_wait(struct esp_req *req, uint32_t timeout_ms);
+void esp_req_cancel(struct esp_req *req);
+
 #endif /* _LIBS_ESPDUINO_H_ */
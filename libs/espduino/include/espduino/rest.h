@@ -23,10 +23,24 @@ typedef enum {
     HTTP_STATUS_OK = 200
 } HTTP_STATUS;
 
+struct esp_rest;
+
+/*
+ * Called with the HTTP status and body when a response arrives, if set
+ * with esp_rest_set_done(). Body is valid only during the call.
+ */
+typedef void (*esp_rest_done_t)(struct esp_rest *, uint16_t http_rc,
+  const void *data, uint16_t len);
+
+/*
+ * Each instance has its own connection within ESPLink, and one request
+ * outstanding at a time. Requests on different instances run in parallel.
+ */
 struct esp_rest {
     uint32_t remote_instance;
     uint32_t timeout;
-    struct PACKET_CMD *res;
+    esp_rest_done_t done;
+    struct esp_req req;
 };
 
 void esp_rest_init(struct esp_rest *er);
@@ -40,6 +54,8 @@ void esp_rest_put(struct esp_rest *, const char *path, const char *data);
 void esp_rest_del(struct esp_rest *, const char *path, const char *data);
 
 void esp_rest_set_timeout(struct esp_rest *, uint32_t ms);
+void esp_rest_set_done(struct esp_rest *, esp_rest_done_t done);
+void esp_rest_set_response_buf(struct esp_rest *, void *buf, uint16_t len);
 uint16_t esp_rest_get_response(struct esp_rest *, char *data, uint16_t *lenp);
 bool esp_rest_set_user_agent(struct esp_rest *, const char *value);
 bool esp_rest_set_content_type(struct esp_rest *, const char *value);
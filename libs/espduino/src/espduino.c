@@ -19,6 +19,7 @@
 
 #include <string.h>
 
+#include "syscfg/syscfg.h"
 #include <os/os.h>
 #include <uart/uart.h>
 
@@ -26,18 +27,40 @@
 
 #include "espduino/espduino.h"
 #include "ringbuf.h"
-#include "crc16.h"
+#include "fastcrc/fastcrc.h"
+
+/*
+ * Outgoing data is SLIP encoded straight into this ring, and UART pulls
+ * it out from interrupt context. Head and tail are free running; size
+ * must be a power of 2.
+ */
+#define ESP_TX_SIZE     MYNEWT_VAL(ESPDUINO_TX_BUF_SIZE)
+#define ESP_TX_MASK     (ESP_TX_SIZE - 1)
+
+#if (ESP_TX_SIZE & ESP_TX_MASK) != 0
+#error "ESPDUINO_TX_BUF_SIZE must be a power of 2"
+#endif
 
 struct espduino {
     struct uart_dev *e_uart;
-    uint8_t e_is_return;
+    volatile uint8_t e_is_return;
     uint16_t e_cur_cmd;
     esp_req_cb e_cur_cb;
     uint32_t e_return_value;
     RINGBUF e_rx;
     uint8_t e_rx_buf[128];
-    RINGBUF e_tx;
-    uint8_t e_tx_buf[32];
+    struct os_eventq *e_evq;        /* RX processed here, if set */
+    struct os_event e_rx_ev;
+    volatile uint8_t e_waiting;     /* tasks sleeping in esp_wait_flag() */
+    struct os_sem e_wait_sem;
+    struct os_mutex e_rx_lock;      /* one task in esp_process() */
+    TAILQ_HEAD(, esp_req) e_reqs;   /* requests waiting for response */
+    volatile uint32_t e_tx_head;
+    volatile uint32_t e_tx_tail;
+    volatile uint8_t e_tx_waiting;
+    struct os_sem e_tx_sem;
+    struct os_mutex e_tx_lock;      /* one frame writer at a time */
+    uint8_t e_tx_buf[ESP_TX_SIZE];
     struct PROTO e_proto;
     uint8_t e_protobuf[512];
 };
@@ -46,6 +69,8 @@ static struct espduino esp;
 
 static int espduino_uart_tx(void *arg);
 static int espduino_uart_rx(void *arg, uint8_t byte);
+static void esp_rx_ev_cb(struct os_event *ev);
+static void esp_wakeup(struct espduino *e);
 
 int
 espduino_init(char *uart, uint32_t speed)
@@ -74,20 +99,43 @@ espduino_init(char *uart, uint32_t speed)
     e->e_proto.isEsc = 0;
 
     RINGBUF_Init(&e->e_rx, e->e_rx_buf, sizeof(e->e_rx_buf));
-    RINGBUF_Init(&e->e_tx, e->e_tx_buf, sizeof(e->e_tx_buf));
+    os_sem_init(&e->e_tx_sem, 0);
+    os_mutex_init(&e->e_tx_lock);
+    os_sem_init(&e->e_wait_sem, 0);
+    os_mutex_init(&e->e_rx_lock);
+    e->e_rx_ev.ev_cb = esp_rx_ev_cb;
+    e->e_rx_ev.ev_arg = e;
+    TAILQ_INIT(&e->e_reqs);
 
     return 0;
 }
 
+void
+espduino_evq_set(struct os_eventq *evq)
+{
+    esp.e_evq = evq;
+}
+
 static int
 espduino_uart_tx(void *arg)
 {
     struct espduino *e = (struct espduino *)arg;
+    uint32_t tail = e->e_tx_tail;
     uint8_t byte;
 
-    if (RINGBUF_Get(&e->e_tx, &byte)) {
+    if (tail == e->e_tx_head) {
         return -1;
     }
+    byte = e->e_tx_buf[tail & ESP_TX_MASK];
+    e->e_tx_tail = ++tail;
+
+    /*
+     * Wake up writer once there's room for a decent sized chunk.
+     */
+    if (e->e_tx_waiting && e->e_tx_head - tail <= ESP_TX_SIZE / 2) {
+        e->e_tx_waiting = 0;
+        os_sem_release(&e->e_tx_sem);
+    }
     return byte;
 }
 
@@ -99,26 +147,160 @@ espduino_uart_rx(void *arg, uint8_t byte)
     if (RINGBUF_Put(&e->e_rx, byte)) {
         return -1;
     }
+    if (e->e_evq) {
+        os_eventq_put(e->e_evq, &e->e_rx_ev);
+    } else {
+        esp_wakeup(e);
+    }
     return 0;
 }
 
 static void
-esp_uart_write(struct espduino *e, uint8_t data)
+esp_rx_ev_cb(struct os_event *ev)
 {
+    esp_process();
+}
+
+/*
+ * Wakes up all tasks in esp_wait_flag(); each one checks its own flag.
+ */
+static void
+esp_wakeup(struct espduino *e)
+{
+    uint8_t cnt;
     int sr;
 
     OS_ENTER_CRITICAL(sr);
-    while (RINGBUF_Put(&e->e_tx, data) != 0) {
+    cnt = e->e_waiting;
+    e->e_waiting = 0;
+    OS_EXIT_CRITICAL(sr);
+    while (cnt--) {
+        os_sem_release(&e->e_wait_sem);
+    }
+}
+
+/*
+ * Waits until *flag is set, or timeout expires. Without event queue
+ * data from ESP is processed here, and we sleep until more arrives.
+ * Several tasks can wait at the same time. A wakeup meant for a task which
+ * already timed out leaves a token in the semaphore; that just makes
+ * someone go around the loop once more. Returns the flag.
+ */
+static int
+esp_wait_flag(struct espduino *e, volatile uint8_t *flag, int32_t ticks)
+{
+    os_time_t end;
+    int32_t left;
+    int sr;
+
+    end = os_time_get() + ticks;
+    while (1) {
+        if (!e->e_evq) {
+            esp_process();
+        }
+        left = end - os_time_get();
+        if (*flag || left <= 0) {
+            break;
+        }
+        if (!os_started()) {
+            continue;
+        }
+        OS_ENTER_CRITICAL(sr);
+        if (*flag || (!e->e_evq && e->e_rx.fill_cnt)) {
+            OS_EXIT_CRITICAL(sr);
+            continue;
+        }
+        e->e_waiting++;
         OS_EXIT_CRITICAL(sr);
-        if (os_started()) {
-            os_time_delay(1);
+        if (os_sem_pend(&e->e_wait_sem, left) == OS_TIMEOUT) {
+            OS_ENTER_CRITICAL(sr);
+            if (e->e_waiting) {
+                e->e_waiting--;
+            }
+            OS_EXIT_CRITICAL(sr);
         }
+    }
+    return *flag;
+}
+
+/*
+ * Waits until transmit ring has room for at least 2 bytes.
+ */
+static void
+esp_tx_wait(struct espduino *e)
+{
+    int sr;
+
+    while (1) {
         OS_ENTER_CRITICAL(sr);
+        if (ESP_TX_SIZE - (e->e_tx_head - e->e_tx_tail) >= 2) {
+            OS_EXIT_CRITICAL(sr);
+            return;
+        }
+        e->e_tx_waiting = os_started();
+        OS_EXIT_CRITICAL(sr);
+        if (os_started()) {
+            os_sem_pend(&e->e_tx_sem, OS_TIMEOUT_NEVER);
+        }
     }
+}
+
+/*
+ * Makes data up to head visible to UART, and starts transmit. Critical
+ * section keeps compiler from moving buffer writes past the head update.
+ */
+static void
+esp_tx_commit(struct espduino *e, uint32_t head)
+{
+    int sr;
+
+    OS_ENTER_CRITICAL(sr);
+    e->e_tx_head = head;
     OS_EXIT_CRITICAL(sr);
     uart_start_tx(e->e_uart);
 }
 
+/*
+ * Copies len bytes to transmit ring. If escape is set, data is SLIP
+ * encoded on the way. UART is kicked once per call, or when ring fills up.
+ */
+static void
+esp_tx_put(struct espduino *e, const void *data_v, int len, int escape)
+{
+    const uint8_t *data = data_v;
+    uint32_t head = e->e_tx_head;
+    uint32_t room;
+    uint8_t c;
+
+    while (len > 0) {
+        room = ESP_TX_SIZE - (head - e->e_tx_tail);
+        if (room < 2) {
+            esp_tx_commit(e, head);
+            esp_tx_wait(e);
+            continue;
+        }
+        while (len > 0 && room >= 2) {
+            c = *data++;
+            len--;
+            if (escape &&
+              (c == SLIP_START || c == SLIP_END || c == SLIP_REPL)) {
+                e->e_tx_buf[head++ & ESP_TX_MASK] = SLIP_REPL;
+                c = SLIP_ESC(c);
+                room--;
+            }
+            e->e_tx_buf[head++ & ESP_TX_MASK] = c;
+            room--;
+        }
+    }
+    esp_tx_commit(e, head);
+}
+
+static void
+esp_uart_write(struct espduino *e, uint8_t data)
+{
+    esp_tx_put(e, &data, 1, 0);
+}
+
 static int
 esp_uart_available(struct espduino *e)
 {
@@ -142,18 +324,23 @@ esp_uart_read(struct espduino *e)
     return data;
 }
 
+/*
+ * Frames from different tasks must not interleave in the transmit ring.
+ * Lock is held from start of request until esp_request_end().
+ */
+static void
+esp_tx_lock(struct espduino *e)
+{
+    if (os_started()) {
+        os_mutex_pend(&e->e_tx_lock, OS_TIMEOUT_NEVER);
+    }
+}
+
 static void
-esp_write_byte(struct espduino *e, uint8_t data)
-{
-    switch (data) {
-    case SLIP_START:
-    case SLIP_END:
-    case SLIP_REPL:
-        esp_uart_write(e, SLIP_REPL);
-        esp_uart_write(e, SLIP_ESC(data));
-        break;
-    default:
-        esp_uart_write(e, data);
+esp_tx_unlock(struct espduino *e)
+{
+    if (os_started()) {
+        os_mutex_release(&e->e_tx_lock);
     }
 }
 
@@ -161,14 +348,8 @@ static uint16_t
 esp_write_crc(struct espduino *e, const void *data_v, uint16_t len,
   uint16_t crc)
 {
-    const uint8_t *data = data_v;
-
-    crc = crc16_data(data, len, crc);
-
-    while (len--) {
-        esp_write_byte(e, *data);
-        data++;
-    }
+    crc = fastcrc16_data(data_v, len, crc);
+    esp_tx_put(e, data_v, len, 1);
     return crc;
 }
 
@@ -179,6 +360,7 @@ esp_request_start(uint16_t cmd, esp_req_cb callback, uint32_t _return,
     struct espduino *e = &esp;
     uint16_t crc = 0;
 
+    esp_tx_lock(e);
     esp_uart_write(e, 0x7e);
     crc = esp_write_crc(e, &cmd, 2, crc);
     crc = esp_write_crc(e, &callback, 4, crc);
@@ -211,12 +393,139 @@ void
 esp_request_end(uint16_t crc)
 {
     struct espduino *e = &esp;
-    uint8_t *crcp = (uint8_t *)&crc;
 
-    esp_write_byte(e, *crcp);
-    crcp++;
-    esp_write_byte(e, *crcp);
+    esp_tx_put(e, &crc, 2, 1);
     esp_uart_write(e, 0x7F);
+    esp_tx_unlock(e);
+}
+
+void
+esp_req_init(struct esp_req *req, esp_req_done_t done, void *arg)
+{
+    memset(req, 0, sizeof(*req));
+    req->er_done = done;
+    req->er_arg = arg;
+    os_sem_init(&req->er_sem, 0);
+}
+
+void
+esp_req_arm(struct esp_req *req, uint32_t token)
+{
+    struct espduino *e = &esp;
+    int sr;
+
+    req->er_token = token;
+    req->er_len = 0;
+    req->er_return = 0;
+    req->er_complete = 0;
+    OS_ENTER_CRITICAL(sr);
+    if (!req->er_pending) {
+        req->er_pending = 1;
+        TAILQ_INSERT_TAIL(&e->e_reqs, req, er_next);
+    }
+    OS_EXIT_CRITICAL(sr);
+}
+
+uint16_t
+esp_req_start(struct esp_req *req, uint16_t cmd, uint32_t _return,
+  uint16_t argc)
+{
+    struct espduino *e = &esp;
+    uint32_t token = (uint32_t)req;
+    uint16_t crc = 0;
+
+    esp_req_arm(req, token);
+
+    esp_tx_lock(e);
+    esp_uart_write(e, 0x7e);
+    crc = esp_write_crc(e, &cmd, 2, crc);
+    crc = esp_write_crc(e, &token, 4, crc);
+    crc = esp_write_crc(e, &_return, 4, crc);
+    crc = esp_write_crc(e, &argc, 2, crc);
+    return crc;
+}
+
+void
+esp_req_cancel(struct esp_req *req)
+{
+    struct espduino *e = &esp;
+    int sr;
+
+    OS_ENTER_CRITICAL(sr);
+    if (req->er_pending) {
+        req->er_pending = 0;
+        TAILQ_REMOVE(&e->e_reqs, req, er_next);
+    }
+    OS_EXIT_CRITICAL(sr);
+}
+
+int
+esp_req_wait(struct esp_req *req, uint32_t timeout_ms)
+{
+    struct espduino *e = &esp;
+    uint32_t ticks;
+
+    ticks = timeout_ms * OS_TICKS_PER_SEC / 1000;
+    if (e->e_evq) {
+        os_sem_pend(&req->er_sem, ticks);
+    } else {
+        esp_wait_flag(e, &req->er_complete, ticks);
+    }
+    if (req->er_pending) {
+        esp_req_cancel(req);
+    }
+    if (!req->er_complete) {
+        return -1;
+    }
+    /* Response might have come right as we timed out */
+    os_sem_pend(&req->er_sem, 0);
+    return 0;
+}
+
+/*
+ * Finds request which response with this token belongs to, and takes it
+ * off the pending list.
+ */
+static struct esp_req *
+esp_req_find(struct espduino *e, uint32_t token)
+{
+    struct esp_req *req;
+    int sr;
+
+    OS_ENTER_CRITICAL(sr);
+    TAILQ_FOREACH(req, &e->e_reqs, er_next) {
+        if (req->er_token == token) {
+            TAILQ_REMOVE(&e->e_reqs, req, er_next);
+            req->er_pending = 0;
+            break;
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+    return req;
+}
+
+static void
+esp_req_complete(struct espduino *e, struct esp_req *req,
+  struct PACKET_CMD *cmd)
+{
+    uint16_t len = 0;
+
+    req->er_return = cmd->_return;
+    if (req->er_buf && cmd->argc > 0) {
+        len = cmd->args.len;
+        if (len > req->er_buf_size) {
+            len = req->er_buf_size;
+        }
+        memcpy(req->er_buf, &cmd->args.data, len);
+    }
+    req->er_len = len;
+    req->er_complete = 1;
+    if (req->er_done) {
+        req->er_done(req, cmd);
+    } else {
+        os_sem_release(&req->er_sem);
+    }
+    esp_wakeup(e);
 }
 
 void
@@ -232,7 +541,6 @@ bool
 esp_ready(void)
 {
     struct espduino *e = &esp;
-    int32_t end;
     uint8_t wait_time;
     uint16_t crc;
 
@@ -240,11 +548,8 @@ esp_ready(void)
         e->e_is_return = 0;
         crc = esp_request_start(CMD_IS_READY, NULL, 1, 0);
         esp_request_end(crc);
-        end = os_time_get() + OS_TICKS_PER_SEC;
-        while (e->e_is_return == 0 && (end - os_time_get() > 0)) {
-            esp_process();
-        }
-        if (e->e_is_return != 0 && e->e_return_value) {
+        if (esp_wait_flag(e, &e->e_is_return, OS_TICKS_PER_SEC) &&
+          e->e_return_value) {
             return true;
         }
     }
@@ -270,15 +575,10 @@ bool
 esp_wait_return_timo(int32_t timeout, uint32_t *ret_value)
 {
     struct espduino *e = &esp;
-    int32_t end;
-
-    end = os_time_get() + timeout * OS_TICKS_PER_SEC / 1000;
 
     e->e_is_return = 0;
-    while (e->e_is_return == 0 && (end - (int32_t)os_time_get() > 0)) {
-        esp_process();
-    }
-    if (e->e_is_return) {
+    if (esp_wait_flag(e, &e->e_is_return,
+        timeout * OS_TICKS_PER_SEC / 1000)) {
         if (ret_value) {
             *ret_value = e->e_return_value;
         }
@@ -292,40 +592,50 @@ void
 esp_proto_completed_cb(struct espduino *e)
 {
     PACKET_CMD *cmd = (PACKET_CMD *)e->e_proto.buf;
-    uint16_t crc = 0;
+    struct fastcrc16 fc;
+    struct esp_req *req;
+    uint16_t crc;
     uint16_t argc, len, resp_crc;
     uint8_t *data_ptr;
 
     argc = cmd->argc;
 
+    /*
+     * CRC covers header and all arguments, which are back to back in
+     * the buffer; find the end, and checksum it all in one go.
+     */
     data_ptr = (uint8_t *)&cmd->args;
-    crc = crc16_data(&cmd->cmd, 12, crc);
-
     while (argc--) {
         len = *((uint16_t *)data_ptr);
-        crc = crc16_data(data_ptr, 2, crc);
-        data_ptr += 2;
-        crc = crc16_data(data_ptr, len, crc);
-        data_ptr += len;
+        data_ptr += 2 + len;
     }
+    fastcrc16_init(&fc, 0);
+    fastcrc16_update(&fc, &cmd->cmd, data_ptr - (uint8_t *)&cmd->cmd);
+    crc = fastcrc16_final(&fc);
     resp_crc = *(uint16_t *)data_ptr;
     if (crc != resp_crc) {
         console_printf("esp: invalid CRC\n");
         return;
     }
 
+    req = esp_req_find(e, cmd->callback);
+    if (req) {
+        esp_req_complete(e, req, cmd);
+        return;
+    }
+
     if (e->e_cur_cmd != cmd->cmd) {
         console_printf("esp: got command %d waiting for %d\n",
           e->e_cur_cmd, cmd->cmd);
         return;
     }
 
-    e->e_is_return = 1;
     e->e_return_value = cmd->_return;
-
     if (e->e_cur_cb != NULL) {
         e->e_cur_cb(cmd);
     }
+    e->e_is_return = 1;
+    esp_wakeup(e);
 }
 
 void
@@ -335,6 +645,13 @@ esp_process(void)
     struct PROTO *pr = &e->e_proto;
     char value;
 
+    /*
+     * Waiting tasks all drain RX themselves when there's no event queue;
+     * protocol state must only be touched by one of them at a time.
+     */
+    if (os_started()) {
+        os_mutex_pend(&e->e_rx_lock, OS_TIMEOUT_NEVER);
+    }
     while (esp_uart_available(e)) {
         value = esp_uart_read(e);
         switch (value) {
@@ -361,4 +678,7 @@ esp_process(void)
             break;
         }
     }
+    if (os_started()) {
+        os_mutex_release(&e->e_rx_lock);
+    }
 }
@@ -9,7 +9,17 @@
 #include "espduino/espduino.h"
 #include "espduino/rest.h"
 
-static struct esp_rest *esp_rest_in_prog;
+static void
+esp_rest_req_done(struct esp_req *req, struct PACKET_CMD *resp)
+{
+    struct esp_rest *er = req->er_arg;
+    uint16_t len = 0;
+
+    if (resp->argc > 0) {
+        len = resp->args.len;
+    }
+    er->done(er, resp->_return, &resp->args.data, len);
+}
 
 void
 esp_rest_init(struct esp_rest *er)
@@ -17,6 +27,8 @@ esp_rest_init(struct esp_rest *er)
     memset(er, 0, sizeof(*er));
     er->remote_instance = 0;
     er->timeout = DEFAULT_REST_TIMEOUT;
+    er->done = NULL;
+    esp_req_init(&er->req, NULL, er);
 }
 
 bool
@@ -30,17 +42,21 @@ esp_rest_begin(struct esp_rest *er, const char *host, uint16_t port,
         sec = 1;
     }
 
-    crc = esp_request_start(CMD_REST_SETUP, NULL, 1, 3);
+    /*
+     * ESPLink sends REST responses with the token used here.
+     */
+    er->req.er_done = NULL;
+    er->remote_instance = 0;
+    crc = esp_req_start(&er->req, CMD_REST_SETUP, 1, 3);
     crc = esp_request_cont(crc, host, strlen(host));
     crc = esp_request_cont(crc, &port, 2);
     crc = esp_request_cont(crc, &sec, 1);
     esp_request_end(crc);
 
-    if (esp_wait_return_timo(er->timeout, &er->remote_instance) &&
-      er->remote_instance != 0) {
-        return true;
+    if (esp_req_wait(&er->req, er->timeout) == 0) {
+        er->remote_instance = er->req.er_return;
     }
-    return false;
+    return er->remote_instance != 0;
 }
 
 void
@@ -52,6 +68,8 @@ esp_rest_request(struct esp_rest *er, const char *path, const char *method,
     if (er->remote_instance == 0) {
         return;
     }
+    er->req.er_done = er->done ? esp_rest_req_done : NULL;
+    esp_req_arm(&er->req, (uint32_t)&er->req);
     if(len > 0) {
         crc = esp_request_start(CMD_REST_REQUEST, 0, 0, 5);
     } else {
@@ -139,35 +157,51 @@ esp_rest_set_timeout(struct esp_rest *er, uint32_t ms)
     er->timeout = ms;
 }
 
-static void
-esp_rest_cb(struct PACKET_CMD *cmd)
+void
+esp_rest_set_done(struct esp_rest *er, esp_rest_done_t done)
 {
-    if (esp_rest_in_prog) {
-        esp_rest_in_prog->res = cmd;
-    }
+    er->done = done;
 }
 
+void
+esp_rest_set_response_buf(struct esp_rest *er, void *buf, uint16_t len)
+{
+    er->req.er_buf = buf;
+    er->req.er_buf_size = len;
+}
+
+/*
+ * Waits for response to previous request, and copies the body to data.
+ * With several requests in flight, set up a response buffer beforehand
+ * with esp_rest_set_response_buf(), or the body is lost if response
+ * arrives before this is called.
+ */
 uint16_t
 esp_rest_get_response(struct esp_rest *er, char *data, uint16_t *lenp)
 {
-    bool rc;
     uint16_t len;
-    uint32_t http_rc;
-
-    er->res = NULL;
-    esp_rest_in_prog = er;
-    esp_wait_for(CMD_REST_EVENTS, esp_rest_cb);
-    rc = esp_wait_return_timo(er->timeout, &http_rc);
-    esp_rest_in_prog = NULL;
-    if (rc != true || er->res == NULL) {
+    int sr;
+
+    OS_ENTER_CRITICAL(sr);
+    if (er->req.er_pending && !er->req.er_buf) {
+        er->req.er_buf = (uint8_t *)data;
+        er->req.er_buf_size = *lenp;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (esp_req_wait(&er->req, er->timeout)) {
         return 0;
     }
-    len = *lenp;
-    if (len > er->res->args.len) {
-        len = er->res->args.len;
+    len = er->req.er_len;
+    if (er->req.er_buf != (uint8_t *)data) {
+        if (len > *lenp) {
+            len = *lenp;
+        }
+        memcpy(data, er->req.er_buf, len);
+    } else {
+        er->req.er_buf = NULL;
     }
-    memcpy(data, &er->res->args.data, len);
     *lenp = len;
 
-    return http_rc;
+    return er->req.er_return;
 }
@@ -0,0 +1,71 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __FASTCRC_H__
+#define __FASTCRC_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC-16/CCITT in its bit reflected form (polynomial 0x8408), with caller
+ * supplied initial value and no final xor. This is the CRC used by
+ * Contiki crc16_data() and by esp-link.
+ */
+struct fastcrc16 {
+    uint16_t fc_crc;
+    uint8_t fc_hw;
+};
+
+void fastcrc16_init(struct fastcrc16 *fc, uint16_t seed);
+void fastcrc16_update(struct fastcrc16 *fc, const void *data, int len);
+uint16_t fastcrc16_final(struct fastcrc16 *fc);
+
+/*
+ * One shot/running calculation without context, always done in software.
+ * Drop-in for Contiki crc16_data().
+ */
+uint16_t fastcrc16_data(const void *data, int len, uint16_t acc);
+
+/*
+ * CRC32 (IEEE 802.3), as computed by zlib crc32().
+ */
+struct fastcrc32 {
+    uint32_t fc_crc;
+    uint8_t fc_hw;
+};
+
+void fastcrc32_init(struct fastcrc32 *fc);
+void fastcrc32_update(struct fastcrc32 *fc, const void *data, int len);
+uint32_t fastcrc32_final(struct fastcrc32 *fc);
+
+/*
+ * Running calculation without context. crc is 0 at start, and result of
+ * previous call when continuing.
+ */
+uint32_t fastcrc32_data(const void *data, int len, uint32_t crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FASTCRC_H__ */
@@ -125,6 +125,15 @@ Invalid argument
 
 #define DATA_PKT_OFFSET	4
 
+/**
+*	@typedef	tpfHifDataWrite
+*	@brief		Writes a packet payload into the chip memory starting at u32Addr, and returns
+*				M2M_SUCCESS or a bus error. Length is known to the caller through pvArg.
+*				Used with hif_send_sg() and sendto_sg() so the payload does not need to be
+*				contiguous.
+*/
+typedef sint8 (*tpfHifDataWrite)(uint32 u32Addr, void *pvArg);
+
 #ifndef BIG_ENDIAN
 #define BYTE_0(word)   					((uint8)(((word) >> 0 	) & 0x000000FFUL))
 #define BYTE_1(word)  	 				((uint8)(((word) >> 8 	) & 0x000000FFUL))
@@ -1539,6 +1539,16 @@ NMI_API sint16 recv(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen, uint32 u32Ti
 */
 NMI_API sint16 recvfrom(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen, uint32 u32Timeoutmsec);
 /** @} */
+/*!
+@fn	\
+	NMI_API void recv_set_buffer(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen);
+
+	Changes the buffer used by a receive which is already in progress. Called from
+	the socket callback while a message is being delivered in chunks
+	(u16RemainingSize != 0), so the rest of the message goes to pvRecvBuf.
+	No new receive request is sent to the WINC.
+*/
+NMI_API void recv_set_buffer(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen);
 /** @defgroup SendFn send
  *   @ingroup SocketAPI
 *  Asynchronous sending function, used to send data on a TCP/UDP socket.
@@ -1660,6 +1670,27 @@ NMI_API sint16 send(SOCKET sock, void *pvSendBuffer, uint16 u16SendLength, uint1
 	The function  returns @ref SOCK_ERR_NO_ERROR for successful operation and a negative value (indicating the error) otherwise. 
 */
 NMI_API sint16 sendto(SOCKET sock, void *pvSendBuffer, uint16 u16SendLength, uint16 flags, struct sockaddr *pstrDestAddr, uint8 u8AddrLen);
+
+/*!
+@typedef	tpfSocketDataWrite
+	Same as @ref tpfHifDataWrite, which sendto_sg() hands it to. Writes the whole datagram
+	payload, the u16SendLength given to sendto_sg(), into the chip memory starting at u32Addr;
+	the callback gets that length through pvArg.
+*/
+typedef tpfHifDataWrite tpfSocketDataWrite;
+
+/*!
+@fn	\
+	NMI_API sint16 sendto_sg(SOCKET sock, tpfSocketDataWrite pfWrite, void *pvArg, uint16 u16SendLength, uint16 flags, struct sockaddr *pstrDestAddr, uint8 u8AddrLen);
+
+	Like @ref sendto, but the payload does not need to be in one contiguous buffer: pfWrite is
+	called with the chip buffer address once it has been allocated, and writes the data there
+	(e.g. one segment of a buffer chain at a time).
+
+@return
+	The function  returns @ref SOCK_ERR_NO_ERROR for successful operation and a negative value (indicating the error) otherwise.
+*/
+NMI_API sint16 sendto_sg(SOCKET sock, tpfSocketDataWrite pfWrite, void *pvArg, uint16 u16SendLength, uint16 flags, struct sockaddr *pstrDestAddr, uint8 u8AddrLen);
 /** @} */
 /** @defgroup CloseSocketFn close
  *  @ingroup SocketAPI
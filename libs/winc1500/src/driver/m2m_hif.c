@@ -289,6 +289,17 @@ sint8 hif_deinit(void * arg)
 
 	return ret;
 }
+typedef struct {
+	uint8	*pu8Buf;
+	uint16	u16Sz;
+} tstrHifFlatBuf;
+
+static sint8 hif_write_flat(uint32 u32Addr, void *pvArg)
+{
+	tstrHifFlatBuf *pstrBuf = (tstrHifFlatBuf *)pvArg;
+
+	return nm_write_block(u32Addr, pstrBuf->pu8Buf, pstrBuf->u16Sz);
+}
 /**
 *	@fn		NMI_API sint8 hif_send(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
 					   uint8 *pu8DataBuf,uint16 u16DataSize, uint16 u16DataOffset)
@@ -310,9 +321,36 @@ sint8 hif_deinit(void * arg)
 				Packet buffer size (including the HIF header).
 *    @return		The function shall return ZERO for successful operation and a negative value otherwise.
 */
-
 sint8 hif_send(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
 			   uint8 *pu8DataBuf,uint16 u16DataSize, uint16 u16DataOffset)
+{
+	tstrHifFlatBuf strBuf;
+
+	if(pu8DataBuf == NULL)
+	{
+		return hif_send_sg(u8Gid, u8Opcode, pu8CtrlBuf, u16CtrlBufSize, NULL, NULL, u16DataSize, u16DataOffset);
+	}
+	strBuf.pu8Buf	= pu8DataBuf;
+	strBuf.u16Sz	= u16DataSize;
+	return hif_send_sg(u8Gid, u8Opcode, pu8CtrlBuf, u16CtrlBufSize, hif_write_flat, &strBuf, u16DataSize, u16DataOffset);
+}
+/**
+*	@fn		NMI_API sint8 hif_send_sg(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
+					   tpfHifDataWrite pfDataWrite,void *pvDataArg,uint16 u16DataSize, uint16 u16DataOffset)
+*	@brief	Send packet using host interface, with the payload written by the caller.
+
+*	@param [in]	pfDataWrite
+*				Called once the chip has allocated its receive buffer, with the address the
+*				payload must be placed at. It writes u16DataSize bytes there, possibly in
+*				several nm_write_block() calls at consecutive addresses.
+*	@param [in]	pvDataArg
+*				Argument passed to pfDataWrite.
+*
+*	Other parameters are as for hif_send().
+*    @return		The function shall return ZERO for successful operation and a negative value otherwise.
+*/
+sint8 hif_send_sg(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
+			   tpfHifDataWrite pfDataWrite,void *pvDataArg,uint16 u16DataSize, uint16 u16DataOffset)
 {
 	sint8		ret = M2M_ERR_SEND;
 	volatile tstrHifHdr	strHif;
@@ -320,7 +358,7 @@ sint8 hif_send(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSiz
 	strHif.u8Opcode		= u8Opcode&(~NBIT7);
 	strHif.u8Gid		= u8Gid;
 	strHif.u16Length	= M2M_HIF_HDR_OFFSET;
-	if(pu8DataBuf != NULL)
+	if(pfDataWrite != NULL)
 	{
 		strHif.u16Length += u16DataOffset + u16DataSize;
 	}
@@ -387,10 +425,10 @@ sint8 hif_send(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSiz
 				if(M2M_SUCCESS != ret) goto ERR1;
 				u32CurrAddr += u16CtrlBufSize;
 			}
-			if(pu8DataBuf != NULL)
+			if(pfDataWrite != NULL)
 			{
 				u32CurrAddr += (u16DataOffset - u16CtrlBufSize);
-				ret = nm_write_block(u32CurrAddr, pu8DataBuf, u16DataSize);
+				ret = pfDataWrite(u32CurrAddr, pvDataArg);
 			#ifdef CONF_WINC_USE_I2C	
 				nm_bsp_sleep(1);
 			#endif
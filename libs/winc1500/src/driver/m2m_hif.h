@@ -133,6 +133,15 @@ NMI_API sint8 hif_deinit(void * arg);
 */
 NMI_API sint8 hif_send(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
 					   uint8 *pu8DataBuf,uint16 u16DataSize, uint16 u16DataOffset);
+/**
+*	@fn		NMI_API sint8 hif_send_sg(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
+					   tpfHifDataWrite pfDataWrite,void *pvDataArg,uint16 u16DataSize, uint16 u16DataOffset)
+*	@brief	Like hif_send(), but the payload is written by pfDataWrite directly to the
+*			chip buffer, e.g. one segment at a time.
+*    @return	The function shall return ZERO for successful operation and a negative value otherwise.
+*/
+NMI_API sint8 hif_send_sg(uint8 u8Gid,uint8 u8Opcode,uint8 *pu8CtrlBuf,uint16 u16CtrlBufSize,
+					   tpfHifDataWrite pfDataWrite,void *pvDataArg,uint16 u16DataSize, uint16 u16DataOffset);
 /*
 *	@fn		hif_receive
 *	@brief	Host interface interrupt serviece routine
@@ -764,6 +764,25 @@ Version
 Date
 		4 June 2012
 *********************************************************************/
+static void sendto_fill_cmd(tstrSendCmd *pstrSendTo, SOCKET sock, uint16 u16SendLength, struct sockaddr *pstrDestAddr)
+{
+	m2m_memset((uint8*)pstrSendTo, 0, sizeof(tstrSendCmd));
+
+	pstrSendTo->sock			= sock;
+	pstrSendTo->u16DataSize		= NM_BSP_B_L_16(u16SendLength);
+	pstrSendTo->u16SessionID	= gastrSockets[sock].u16SessionID;
+
+	if(pstrDestAddr != NULL)
+	{
+		struct sockaddr_in	*pstrAddr;
+		pstrAddr = (void*)pstrDestAddr;
+
+		pstrSendTo->strAddr.u16Family	= pstrAddr->sin_family;
+		pstrSendTo->strAddr.u16Port		= pstrAddr->sin_port;
+		pstrSendTo->strAddr.u32IPAddr	= pstrAddr->sin_addr.s_addr;
+	}
+}
+
 sint16 sendto(SOCKET sock, void *pvSendBuffer, uint16 u16SendLength, uint16 flags, struct sockaddr *pstrDestAddr, uint8 u8AddrLen)
 {
 	sint16	s16Ret = SOCK_ERR_INVALID_ARG;
@@ -774,21 +793,7 @@ sint16 sendto(SOCKET sock, void *pvSendBuffer, uint16 u16SendLength, uint16 flag
 		{
 			tstrSendCmd	strSendTo;
 
-			m2m_memset((uint8*)&strSendTo, 0, sizeof(tstrSendCmd));
-
-			strSendTo.sock			= sock;
-			strSendTo.u16DataSize	= NM_BSP_B_L_16(u16SendLength);
-			strSendTo.u16SessionID	= gastrSockets[sock].u16SessionID;
-			
-			if(pstrDestAddr != NULL)
-			{
-				struct sockaddr_in	*pstrAddr;
-				pstrAddr = (void*)pstrDestAddr;
-
-				strSendTo.strAddr.u16Family	= pstrAddr->sin_family;
-				strSendTo.strAddr.u16Port	= pstrAddr->sin_port;
-				strSendTo.strAddr.u32IPAddr	= pstrAddr->sin_addr.s_addr;
-			}
+			sendto_fill_cmd(&strSendTo, sock, u16SendLength, pstrDestAddr);
 			s16Ret = SOCKET_REQUEST(SOCKET_CMD_SENDTO|M2M_REQ_DATA_PKT, (uint8*)&strSendTo,  sizeof(tstrSendCmd),
 				pvSendBuffer, u16SendLength, UDP_TX_PACKET_OFFSET);
 
@@ -801,6 +806,36 @@ sint16 sendto(SOCKET sock, void *pvSendBuffer, uint16 u16SendLength, uint16 flag
 	return s16Ret;
 }
 /*********************************************************************
+Function
+		sendto_sg
+
+Description
+		Same as sendto(), but the datagram is written to the chip by
+		pfWrite instead of being copied from one contiguous buffer.
+
+Return
+
+*********************************************************************/
+sint16 sendto_sg(SOCKET sock, tpfSocketDataWrite pfWrite, void *pvArg, uint16 u16SendLength, uint16 flags, struct sockaddr *pstrDestAddr, uint8 u8AddrLen)
+{
+	sint16	s16Ret = SOCK_ERR_INVALID_ARG;
+
+	if((sock >= 0) && (pfWrite != NULL) && (u16SendLength <= SOCKET_BUFFER_MAX_LENGTH) && (gastrSockets[sock].bIsUsed == 1))
+	{
+		tstrSendCmd	strSendTo;
+
+		sendto_fill_cmd(&strSendTo, sock, u16SendLength, pstrDestAddr);
+		s16Ret = hif_send_sg(M2M_REQ_GROUP_IP, SOCKET_CMD_SENDTO|M2M_REQ_DATA_PKT, (uint8*)&strSendTo, sizeof(tstrSendCmd),
+			pfWrite, pvArg, u16SendLength, UDP_TX_PACKET_OFFSET);
+
+		if(s16Ret != SOCK_ERR_NO_ERROR)
+		{
+			s16Ret = SOCK_ERR_BUFFER_FULL;
+		}
+	}
+	return s16Ret;
+}
+/*********************************************************************
 Function
 		recv
 
@@ -960,6 +995,27 @@ sint16 recvfrom(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen, uint32 u32Timeou
 	return s16Ret;
 }
 /*********************************************************************
+Function
+		recv_set_buffer
+
+Description
+		Point a receive which is in progress at a new buffer. Used from
+		the socket callback when data is delivered in chunks, so that the
+		next chunk is read to a different buffer. Does not issue a new
+		receive request to the chip.
+
+Return
+		None.
+*********************************************************************/
+void recv_set_buffer(SOCKET sock, void *pvRecvBuf, uint16 u16BufLen)
+{
+	if((sock >= 0) && (sock < MAX_SOCKET) && (gastrSockets[sock].bIsUsed == 1))
+	{
+		gastrSockets[sock].pu8UserBuffer = (uint8*)pvRecvBuf;
+		gastrSockets[sock].u16UserBufferSize = u16BufLen;
+	}
+}
+/*********************************************************************
 Function
 		nmi_inet_addr
 
@@ -35,7 +35,11 @@
 
 #include "winc1500_priv.h"
 
-#define WINC1500_POLL_ITVL      100
+/*
+ * Chip interrupts drive event processing. The callout is only a fallback in
+ * case an interrupt gets lost.
+ */
+#define WINC1500_WATCHDOG_ITVL  OS_TICKS_PER_SEC
 
 struct winc1500 winc1500;
 
@@ -157,7 +161,7 @@ winc1500_events(struct os_event *ev)
     m2m_wifi_handle_events(NULL);
     os_mutex_release(&w->w_if.wi_mtx);
     winc1500_socket_poll();
-    os_callout_reset(&w->w_timer, WINC1500_POLL_ITVL);
+    os_callout_reset(&w->w_timer, WINC1500_WATCHDOG_ITVL);
 }
 
 static int
@@ -170,7 +174,7 @@ winc1500_start(struct wifi_if *wi)
     init_param.pfAppWifiCb = winc1500_callback;
     rc = m2m_wifi_init(&init_param);
     if (rc == 0) {
-        os_callout_reset(&w->w_timer, WINC1500_POLL_ITVL);
+        os_callout_reset(&w->w_timer, WINC1500_WATCHDOG_ITVL);
     }
     winc1500_socket_start();
     return rc;
@@ -223,6 +227,8 @@ winc1500_init(void)
         return -1;
     }
     os_callout_init(&w->w_timer, &wifi_evq, winc1500_events, w);
+    w->w_event.ev_cb = winc1500_events;
+    w->w_event.ev_arg = w;
 
     rc = hal_gpio_init_out(WINC1500_PIN_RESET, 0); /* reset when 0 */
     assert(rc == 0);
@@ -36,6 +36,19 @@ nm_bsp_sleep(uint32 msec)
     }
 }
 
+static tpfNmBspIsr winc1500_hif_isr;
+
+/*
+ * Let HIF count the interrupt, and then get the winc1500 task to process it
+ * right away.
+ */
+static void
+winc1500_bsp_isr(void *arg)
+{
+    winc1500_hif_isr();
+    os_eventq_put(&wifi_evq, &winc1500.w_event);
+}
+
 /*
  * Register interrupt handler
  */
@@ -45,8 +58,9 @@ nm_bsp_register_isr(tpfNmBspIsr isr)
     int rc;
     static uint8_t reg_done;
 
+    winc1500_hif_isr = isr;
     if (!reg_done) {
-        rc = hal_gpio_irq_init(WINC1500_PIN_IRQ, (hal_gpio_irq_handler_t)isr,
+        rc = hal_gpio_irq_init(WINC1500_PIN_IRQ, winc1500_bsp_isr,
                                NULL, HAL_GPIO_TRIG_FALLING, HAL_GPIO_PULL_UP);
         assert(rc == 0);
         reg_done = 1;
@@ -26,6 +26,7 @@
 struct winc1500 {
     struct wifi_if w_if;
     struct os_callout w_timer;
+    struct os_event w_event;        /* posted from chip interrupt */
     uint8_t w_scan_cnt;
     uint8_t w_scan_idx;
     uint8_t w_up:1;
@@ -20,10 +20,12 @@
 #include <assert.h>
 #include <string.h>
 
+#include <syscfg/syscfg.h>
 #include <os/os.h>
 #include <os/endian.h>
 #include <bsp/bsp.h>
 #include <hal/hal_gpio.h>
+#include <stats/stats.h>
 
 #include <mn_socket/mn_socket.h>
 #include <mn_socket/mn_socket_ops.h>
@@ -32,6 +34,7 @@
 #include "winc1500/socket/socket.h"
 #include "winc1500_priv.h"
 #include "driver/m2m_hif.h"
+#include "driver/nmbus.h"
 
 #ifdef SOCK_DEBUG
 #define DEBUG_PRINTF console_printf
@@ -54,6 +57,8 @@ static int winc1500_sock_setsockopt(struct mn_socket *, uint8_t level,
 static int winc1500_sock_getpeername(struct mn_socket *, struct mn_sockaddr *);
 static int winc1500_itf_getnext(struct mn_itf *);
 static int winc1500_itf_addr_getnext(struct mn_itf *, struct mn_itf_addr *);
+static struct winc1500_rx_slot *winc1500_sock_rx_slot(int idx);
+static void winc1500_sock_rx_release(struct winc1500_rx_slot *);
 
 /*
  * MAX_SOCKET comes from socket/socket.h
@@ -73,22 +78,68 @@ static struct winc1500_sock {
     uint8_t ws_waiting:1;           /* set if waiting on semaphore */
     uint8_t ws_poll:1;              /* whether should be polled for data */
     uint8_t ws_closed:1;            /* if we know that remote has closed */
+    uint8_t ws_rx_posted:1;         /* receive staged with WINC1500 */
+    uint8_t ws_rx_idle:1;           /* last receive timed out */
     uint8_t ws_err;                 /* err return for sync calls */
     uint8_t ws_type;                /* SOCK_DGRAM/SOCK_STREAM */
     STAILQ_HEAD(, os_mbuf_pkthdr) ws_rx; /* RX data queue */
     struct os_mbuf *ws_tx;          /* SOCK_STREAM, data being TX'd */
 } winc1500_socks[MAX_SOCKET];
 
-#define WINC1500_SOCK_RX_SIZE       1500
+#define WINC1500_SOCK_RX_SLOTS      MYNEWT_VAL(WINC1500_SOCK_RX_SLOTS)
 
 /*
- * State of socket RX polling. This is done periodically.
+ * Received data is stored in mbufs from a pool of our own, so that
+ * running out of msys elsewhere does not stop socket RX (and vice versa).
+ * First mbuf in a packet carries pkthdr and the remote address; block
+ * size is picked so that WINC1500_RX_MBUF_SIZE bytes of data still fit.
+ */
+#define WINC1500_RX_MBUF_CNT        MYNEWT_VAL(WINC1500_RX_MBUF_COUNT)
+#define WINC1500_RX_MBUF_BLKSZ                                          \
+    (OS_ALIGN(MYNEWT_VAL(WINC1500_RX_MBUF_SIZE), 4) +                   \
+     sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) +           \
+     sizeof(struct mn_sockaddr_in))
+
+static os_membuf_t winc1500_rx_mem[
+    OS_MEMPOOL_SIZE(WINC1500_RX_MBUF_CNT, WINC1500_RX_MBUF_BLKSZ)];
+static struct os_mempool winc1500_rx_mempool;
+static struct os_mbuf_pool winc1500_rx_mbuf_pool;
+
+STATS_SECT_START(winc1500_rx_stats)
+    STATS_SECT_ENTRY(alloc_fail)    /* mbuf allocation failures */
+    STATS_SECT_ENTRY(hiwat)         /* max number of mbufs in use */
+    STATS_SECT_ENTRY(dropped)       /* packets dropped, no mbufs */
+STATS_SECT_END
+
+STATS_NAME_START(winc1500_rx_stats)
+    STATS_NAME(winc1500_rx_stats, alloc_fail)
+    STATS_NAME(winc1500_rx_stats, hiwat)
+    STATS_NAME(winc1500_rx_stats, dropped)
+STATS_NAME_END(winc1500_rx_stats)
+
+static STATS_SECT_DECL(winc1500_rx_stats) winc1500_rx_stats;
+
+/*
+ * Receive staged with WINC1500. Each slot has one mbuf allocated ahead
+ * of time; it's kept if the receive times out. Once the first part of
+ * the data comes in, chain is extended to match the size of the rest.
+ */
+struct winc1500_rx_slot {
+    struct os_mbuf *rs_buf;         /* chain of mbufs to receive data to */
+    struct os_mbuf *rs_cur;         /* currently receiving to this */
+    int8_t rs_idx;                  /* socket receiving with this, or -1 */
+    uint8_t rs_drop:1;              /* no mbufs for rest of the data */
+};
+
+/*
+ * State of socket RX polling. Up to WINC1500_SOCK_RX_SLOTS sockets have
+ * receive outstanding at the same time. Sockets which returned data
+ * last time around get to go first, sockets which timed out get the
+ * slots which are left over.
  */
 static struct winc1500_sock_state {
-    uint8_t polling;                /* if polling is going on */
-    struct os_mbuf *rx_buf;         /* chain of mbufs to receive data to */
-    struct os_mbuf *cur_buf;        /* currently receiving to this */
-    uint8_t tx_buf[WINC1500_SOCK_RX_SIZE]; /* send buffer */
+    uint8_t next_idx;               /* where to continue round-robin */
+    struct winc1500_rx_slot slots[WINC1500_SOCK_RX_SLOTS];
 } winc1500_socket_state;
 
 static const struct mn_socket_ops winc1500_sock_ops = {
@@ -259,6 +310,14 @@ winc1500_sock_close(struct mn_socket *sock)
     ws->ws_type = 0;
     ws->ws_poll = 0;
     ws->ws_closed = 0;
+    ws->ws_rx_idle = 0;
+    if (ws->ws_rx_posted) {
+        /*
+         * Reply to outstanding receive gets discarded by socket layer,
+         * as session ID won't match anymore.
+         */
+        winc1500_sock_rx_release(winc1500_sock_rx_slot(ws->ws_idx));
+    }
 
     /*
      * When socket is closed, we must free all mbufs which might be
@@ -384,16 +443,36 @@ winc1500_stream_tx(struct winc1500_sock *ws, int notify)
     return rc;
 }
 
+/*
+ * Called from hif_send_sg() once WINC1500 has allocated room for the
+ * datagram. Writes the mbuf chain there one segment at a time.
+ */
+static sint8
+winc1500_sock_tx_mbuf(uint32 addr, void *arg)
+{
+    struct os_mbuf *m;
+    sint8 rc;
+
+    for (m = arg; m; m = SLIST_NEXT(m, om_next)) {
+        if (m->om_len == 0) {
+            continue;
+        }
+        rc = nm_write_block(addr, m->om_data, m->om_len);
+        if (rc != M2M_SUCCESS) {
+            return rc;
+        }
+        addr += m->om_len;
+    }
+    return M2M_SUCCESS;
+}
+
 static int
 winc1500_sock_sendto(struct mn_socket *sock, struct os_mbuf *m,
   struct mn_sockaddr *dst)
 {
-    struct winc1500_sock_state *wss = &winc1500_socket_state;
     struct winc1500_sock *ws = (struct winc1500_sock *)sock;
     struct sockaddr_in sin;
-    struct os_mbuf *o;
     int rc;
-    int off;
 
     if (ws->ws_type == SOCK_STREAM) {
         if (dst) {
@@ -411,29 +490,21 @@ winc1500_sock_sendto(struct mn_socket *sock, struct os_mbuf *m,
         rc = winc1500_stream_tx(ws, 0);
     } else {
         /*
-         * XXXX every write presumably sends a single datagram.
-         * WINC1500 API takes a single pointer to data, along with length.
-         * So we have to copy the mbuf chain into a contiguous area of
-         * memory before calling sendto().
+         * Every write sends a single datagram. Segments of the mbuf chain
+         * are written straight to the chip's HIF buffer, back-to-back.
          */
         rc = winc1500_mn_addr_to_addr((struct mn_sockaddr_in *)dst, &sin);
         if (rc) {
             goto err;
         }
+        if (OS_MBUF_PKTLEN(m) > SOCKET_BUFFER_MAX_LENGTH) {
+            rc = MN_EINVAL;
+            goto err;
+        }
 
         os_mutex_pend(&winc1500.w_if.wi_mtx, OS_TIMEOUT_NEVER);
-        off = 0;
-        for (o = m; o; o = SLIST_NEXT(o, om_next)) {
-            if (off + o->om_len > sizeof(wss->tx_buf)) {
-                rc = MN_EINVAL;
-                os_mutex_release(&winc1500.w_if.wi_mtx);
-                goto err;
-            }
-            os_mbuf_copydata(o, 0, o->om_len, &wss->tx_buf[off]);
-            off += o->om_len;
-        }
-        rc = sendto(ws->ws_idx, wss->tx_buf, off, 0,
-          (struct sockaddr *)&sin, sizeof(sin));
+        rc = sendto_sg(ws->ws_idx, winc1500_sock_tx_mbuf, m,
+          OS_MBUF_PKTLEN(m), 0, (struct sockaddr *)&sin, sizeof(sin));
         os_mutex_release(&winc1500.w_if.wi_mtx);
         if (rc) {
             rc = winc1500_err_to_mn_err(rc);
@@ -569,85 +640,151 @@ winc1500_itf_addr_getnext(struct mn_itf *mi, struct mn_itf_addr *mia)
 }
 
 /*
- * Try to receive data for first suitable socket, starting from winc1500_socks
- * array index idx.
- * If there is a response, the mbuf allocated here is moved to socket's RX
- * queue.
+ * Returns the slot which has receive staged for socket idx.
  */
-static int
-winc1500_sock_start_rx(struct winc1500_sock_state *wss, int idx, int cont)
+static struct winc1500_rx_slot *
+winc1500_sock_rx_slot(int idx)
 {
-    struct winc1500_sock *ws;
-    struct os_mbuf *m;
-    struct os_mbuf *n;
-    int need;
-    int rc;
+    struct winc1500_sock_state *wss = &winc1500_socket_state;
+    int i;
 
-    wss->polling = 0;
-    if (!wss->rx_buf) {
-        /*
-         * Allocate a chain of mbufs, with total available space
-         * more than WINC1500_SOCK_RX_SIZE bytes.
-         */
-        m = os_msys_get_pkthdr(WINC1500_SOCK_RX_SIZE,
-          sizeof(struct mn_sockaddr_in));
-        if (!m) {
-            goto flow_ctl;
-        }
-        wss->rx_buf = m;
-        need = WINC1500_SOCK_RX_SIZE - OS_MBUF_TRAILINGSPACE(m);
-
-        while (need > 0) {
-            n = os_msys_get(need, 0);
-            if (n) {
-                SLIST_NEXT(m, om_next) = n;
-                m = n;
-                need -= OS_MBUF_TRAILINGSPACE(n);
-            } else {
-                os_mbuf_free_chain(wss->rx_buf);
-                wss->rx_buf = NULL;
-                goto flow_ctl;
-            }
+    for (i = 0; i < WINC1500_SOCK_RX_SLOTS; i++) {
+        if (wss->slots[i].rs_idx == idx) {
+            return &wss->slots[i];
         }
     }
+    return NULL;
+}
 
-    /*
-     * We have mbufs to receive a packet to.
-     */
-    hif_flow_ctrl(0);
+/*
+ * Make slot available for staging another receive. If there's a chain
+ * of mbufs still attached, it gets reused.
+ */
+static void
+winc1500_sock_rx_release(struct winc1500_rx_slot *rs)
+{
+    struct os_mbuf *m;
 
-    for ( ; idx < MAX_SOCKET; idx++) {
-        ws = &winc1500_socks[idx];
-        if (!ws->ws_poll) {
-            continue;
+    if (rs->rs_idx >= 0) {
+        winc1500_socks[rs->rs_idx].ws_rx_posted = 0;
+        rs->rs_idx = -1;
+    }
+    m = rs->rs_buf;
+    if (m) {
+        if (SLIST_NEXT(m, om_next)) {
+            os_mbuf_free_chain(SLIST_NEXT(m, om_next));
+            SLIST_NEXT(m, om_next) = NULL;
         }
+        OS_MBUF_PKTLEN(m) = 0;
+        m->om_len = 0;
+    }
+    rs->rs_cur = m;
+    rs->rs_drop = 0;
+}
 
-        if (!cont) {
-            /*
-             * Poll socket for data. Tell it to write the data to first mbuf
-             * in the chain.
-             */
-            m = wss->rx_buf;
-        } else {
-            m = SLIST_NEXT(wss->cur_buf, om_next);
-        }
-        rc = recvfrom(idx, m->om_data, OS_MBUF_TRAILINGSPACE(m), 1);
-        if (rc == 0) {
-            wss->cur_buf = m;
-            wss->polling = 1;
-            return 0;
-        } else {
+static void
+winc1500_sock_rx_hiwat(void)
+{
+    int used;
+
+    used = winc1500_rx_mempool.mp_num_blocks - winc1500_rx_mempool.mp_num_free;
+    /* Compared against the stat itself, so it is right after a reset */
+    if (used > winc1500_rx_stats.STATS_SECT_VAR(hiwat)) {
+        winc1500_rx_stats.STATS_SECT_VAR(hiwat) = used;
+    }
+}
+
+/*
+ * Allocate the first mbuf for a slot. The rest of the chain is
+ * allocated once we know how much data there is.
+ */
+static int
+winc1500_sock_rx_alloc(struct winc1500_sock_state *wss,
+  struct winc1500_rx_slot *rs)
+{
+    if (rs->rs_buf) {
+        return 0;
+    }
+    rs->rs_buf = os_mbuf_get_pkthdr(&winc1500_rx_mbuf_pool,
+      sizeof(struct mn_sockaddr_in));
+    if (!rs->rs_buf) {
+        STATS_INC(winc1500_rx_stats, alloc_fail);
+        return -1;
+    }
+    winc1500_sock_rx_hiwat();
+    rs->rs_cur = rs->rs_buf;
+    return 0;
+}
+
+/*
+ * First part of the data has come in to m, and there is len bytes more.
+ * Extend the chain to fit exactly that.
+ */
+static int
+winc1500_sock_rx_extend(struct winc1500_sock_state *wss,
+  struct winc1500_rx_slot *rs, int len)
+{
+    struct os_mbuf *m;
+    struct os_mbuf *n;
+
+    m = rs->rs_cur;
+    while (len > 0) {
+        n = os_mbuf_get(&winc1500_rx_mbuf_pool, 0);
+        if (!n) {
+            STATS_INC(winc1500_rx_stats, alloc_fail);
+            if (SLIST_NEXT(rs->rs_cur, om_next)) {
+                os_mbuf_free_chain(SLIST_NEXT(rs->rs_cur, om_next));
+                SLIST_NEXT(rs->rs_cur, om_next) = NULL;
+            }
             return -1;
         }
+        SLIST_NEXT(m, om_next) = n;
+        m = n;
+        len -= OS_MBUF_TRAILINGSPACE(n);
     }
+    winc1500_sock_rx_hiwat();
     return 0;
-flow_ctl:
+}
 
-    /*
-     * We don't have mbuf to receive data to.
-     */
-    hif_flow_ctrl(1);
-    return -1;
+/*
+ * Stage receives for sockets which want to be polled, as long as there
+ * are free slots. If we run out of mbufs, the remaining sockets are
+ * left alone; WINC1500 holds on to data until receive is staged, and
+ * we'll try again on the next event.
+ */
+static void
+winc1500_sock_rx_sched(struct winc1500_sock_state *wss)
+{
+    struct winc1500_rx_slot *rs;
+    struct winc1500_sock *ws;
+    int pass;
+    int idx;
+    int i;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < MAX_SOCKET; i++) {
+            idx = (wss->next_idx + i) % MAX_SOCKET;
+            ws = &winc1500_socks[idx];
+            if (!ws->ws_poll || ws->ws_rx_posted || ws->ws_rx_idle != pass) {
+                continue;
+            }
+            rs = winc1500_sock_rx_slot(-1);
+            if (!rs) {
+                return;
+            }
+            if (winc1500_sock_rx_alloc(wss, rs)) {
+                return;
+            }
+            if (recvfrom(idx, rs->rs_buf->om_data,
+                OS_MBUF_TRAILINGSPACE(rs->rs_buf),
+                MYNEWT_VAL(WINC1500_SOCK_RX_TMO))) {
+                continue;
+            }
+            rs->rs_idx = idx;
+            ws->ws_rx_posted = 1;
+            wss->next_idx = (idx + 1) % MAX_SOCKET;
+        }
+    }
 }
 
 /*
@@ -666,9 +803,9 @@ winc1500_sock_cb(SOCKET idx, uint8_t msg, void *data)
     tstrSocketRecvMsg *recv_msg;
     struct winc1500_sock *ws;
     struct winc1500_sock *new_ws;
+    struct winc1500_rx_slot *rs;
     struct os_mbuf *m;
     int len;
-    int cont;
 
     if (msg != SOCKET_MSG_RECV && msg != SOCKET_MSG_RECVFROM) {
         DEBUG_PRINTF("sock cb %d msg %d data %x\n", idx, msg, (int)data);
@@ -718,45 +855,74 @@ winc1500_sock_cb(SOCKET idx, uint8_t msg, void *data)
     case SOCKET_MSG_RECVFROM:
         recv_msg = (tstrSocketRecvMsg *)data;
         len = recv_msg->s16BufferSize;
-        cont = 0;
+        rs = winc1500_sock_rx_slot(idx);
+        if (!rs) {
+            break;
+        }
         if (len == SOCK_ERR_TIMEOUT) {
-            idx = idx + 1;
+            ws->ws_rx_idle = 1;
+            winc1500_sock_rx_release(rs);
         } else {
             DEBUG_PRINTF(" %s %d %d %x %x\n",
               msg == SOCKET_MSG_RECV ? "recv" : "recvfrom",
               recv_msg->s16BufferSize, recv_msg->u16RemainingSize,
               (int)recv_msg->pu8Buffer,
-              (int)wss->rx_buf);
+              (int)rs->rs_buf);
             if (len > 0) {
-                assert(wss->cur_buf);
-                m = wss->cur_buf;
-                OS_MBUF_PKTLEN(wss->rx_buf) += len;
-                m->om_len = len;
-                if (ws->ws_type == SOCK_DGRAM && m == wss->rx_buf) {
+                ws->ws_rx_idle = 0;
+                m = rs->rs_cur;
+                if (!rs->rs_drop) {
+                    OS_MBUF_PKTLEN(rs->rs_buf) += len;
+                    m->om_len = len;
+                }
+                if (ws->ws_type == SOCK_DGRAM && m == rs->rs_buf) {
                     winc1500_addr_to_mn_addr(&recv_msg->strRemoteAddr,
                       OS_MBUF_USRHDR(m));
                 }
                 if (recv_msg->u16RemainingSize) {
-                    cont = 1;
-                } else {
-                    if (SLIST_NEXT(m, om_next)) {
-                        os_mbuf_free_chain(SLIST_NEXT(m, om_next));
-                        SLIST_NEXT(m, om_next) = NULL;
+                    /*
+                     * Rest of the data goes to next mbuf in the chain.
+                     * If we can't get mbufs for it, data is read in
+                     * to the same mbuf and dropped at the end.
+                     * Socket layer is still reading from the chip, so
+                     * don't stage anything new now.
+                     */
+                    if (!rs->rs_drop && !SLIST_NEXT(m, om_next) &&
+                      winc1500_sock_rx_extend(wss, rs,
+                        recv_msg->u16RemainingSize)) {
+                        rs->rs_drop = 1;
+                    }
+                    if (!rs->rs_drop) {
+                        m = SLIST_NEXT(m, om_next);
+                        rs->rs_cur = m;
                     }
-                    m = wss->rx_buf;
-                    wss->rx_buf = NULL;
-                    STAILQ_INSERT_TAIL(&ws->ws_rx, OS_MBUF_PKTHDR(m), omp_next);
-                    mn_socket_readable(&ws->ws_sock, 0);
+                    recv_set_buffer(idx, m->om_data, OS_MBUF_TRAILINGSPACE(m));
+                    break;
+                }
+                if (rs->rs_drop) {
+                    STATS_INC(winc1500_rx_stats, dropped);
+                    winc1500_sock_rx_release(rs);
+                    winc1500_sock_rx_sched(wss);
+                    break;
+                }
+                if (SLIST_NEXT(m, om_next)) {
+                    os_mbuf_free_chain(SLIST_NEXT(m, om_next));
+                    SLIST_NEXT(m, om_next) = NULL;
                 }
+                m = rs->rs_buf;
+                rs->rs_buf = NULL;
+                winc1500_sock_rx_release(rs);
+                STAILQ_INSERT_TAIL(&ws->ws_rx, OS_MBUF_PKTHDR(m), omp_next);
+                mn_socket_readable(&ws->ws_sock, 0);
             } else {
-                idx = idx + 1;
+                winc1500_sock_rx_release(rs);
                 ws->ws_closed = 1;
                 ws->ws_poll = 0;
                 winc1500_sock_wake(ws, len);
                 mn_socket_readable(&ws->ws_sock, winc1500_err_to_mn_err(len));
             }
         }
-        winc1500_sock_start_rx(wss, idx, cont);
+        winc1500_sock_rx_sched(wss);
         break;
     case SOCKET_MSG_SEND:
         DEBUG_PRINTF(" send %d\n", *(sint16 *)data);
@@ -788,22 +954,36 @@ winc1500_socket_start(void)
 void
 winc1500_socket_poll(void)
 {
-    struct winc1500_sock_state *wss = &winc1500_socket_state;
-
-    if (wss->polling) {
-        return;
-    }
-    winc1500_sock_start_rx(wss, 0, 0);
+    os_mutex_pend(&winc1500.w_if.wi_mtx, OS_TIMEOUT_NEVER);
+    winc1500_sock_rx_sched(&winc1500_socket_state);
+    os_mutex_release(&winc1500.w_if.wi_mtx);
 }
 
 int
 winc1500_socket_init(void)
 {
     int i;
+    int rc;
 
     for (i = 0; i < sizeof(winc1500_socks) / sizeof(winc1500_socks[0]); i++) {
         winc1500_socks[i].ws_idx = i;
         STAILQ_INIT(&winc1500_socks[i].ws_rx);
     }
+    for (i = 0; i < WINC1500_SOCK_RX_SLOTS; i++) {
+        winc1500_socket_state.slots[i].rs_idx = -1;
+    }
+
+    rc = os_mempool_init(&winc1500_rx_mempool, WINC1500_RX_MBUF_CNT,
+      WINC1500_RX_MBUF_BLKSZ, winc1500_rx_mem, "winc1500_rx");
+    assert(rc == 0);
+    rc = os_mbuf_pool_init(&winc1500_rx_mbuf_pool, &winc1500_rx_mempool,
+      WINC1500_RX_MBUF_BLKSZ, WINC1500_RX_MBUF_CNT);
+    assert(rc == 0);
+
+    rc = stats_init_and_reg(STATS_HDR(winc1500_rx_stats),
+      STATS_SIZE_INIT_PARMS(winc1500_rx_stats, STATS_SIZE_32),
+      STATS_NAME_INIT_PARMS(winc1500_rx_stats), "winc1500_rx");
+    assert(rc == 0);
+
     return mn_socket_ops_reg(&winc1500_sock_ops);
 }
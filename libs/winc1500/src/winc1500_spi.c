@@ -29,12 +29,18 @@
 
 #include "winc1500_priv.h"
 
-#define NM_BUS_MAX_TRX_SZ       256
+#define NM_BUS_MAX_TRX_SZ       1024
 
 tstrNmBusCapabilities egstrNmBusCapabilities = {
         NM_BUS_MAX_TRX_SZ
 };
 
+/*
+ * Clocked out while reading.  Lives in flash; both the CPU and the DMA
+ * controller can read it from there.
+ */
+static const uint8_t nm_spi_dummy_tx[NM_BUS_MAX_TRX_SZ];
+
 int winc1500_spi_inited;
 
 sint8
@@ -77,31 +83,40 @@ nm_bus_deinit(void)
     return M2M_SUCCESS;
 }
 
+/*
+ * Each request goes out as a single hal_spi_txrx() call.  Reads are split
+ * only if they are longer than the dummy TX buffer, which nmbus never
+ * asks for.
+ */
 static sint8
 nm_spi_rw(uint8 *pu8Mosi, uint8 *pu8Miso, uint16 u16Sz)
 {
     int rc = M2M_SUCCESS;
-    uint8_t tx = 0;
-    uint8_t rx;
+    uint16_t len;
 
     /* chip select */
     hal_gpio_write(WINC1500_SPI_SSN, 0);
-    while (u16Sz) {
-        if (pu8Mosi) {
-            tx = *pu8Mosi;
-            pu8Mosi++;
-        }
-        //rx = hal_spi_tx_val(BSP_WINC1500_SPI_PORT, tx);
-        rc = hal_spi_txrx(BSP_WINC1500_SPI_PORT, &tx, &rx, 1);
-        if (rc != 0) {
+    if (pu8Mosi) {
+        if (u16Sz &&
+            hal_spi_txrx(BSP_WINC1500_SPI_PORT, pu8Mosi, pu8Miso, u16Sz)) {
             rc = M2M_ERR_BUS_FAIL;
-            break;
         }
-        if (pu8Miso) {
-            *pu8Miso = rx;
-            pu8Miso++;
+    } else {
+        while (u16Sz) {
+            len = u16Sz;
+            if (len > sizeof(nm_spi_dummy_tx)) {
+                len = sizeof(nm_spi_dummy_tx);
+            }
+            if (hal_spi_txrx(BSP_WINC1500_SPI_PORT, (void *)nm_spi_dummy_tx,
+                             pu8Miso, len)) {
+                rc = M2M_ERR_BUS_FAIL;
+                break;
+            }
+            if (pu8Miso) {
+                pu8Miso += len;
+            }
+            u16Sz -= len;
         }
-        u16Sz--;
     }
 
     /* chip deselect */